@@ -0,0 +1,209 @@
+//
+// Compact vertex, edge and face adjacency of an indexed triangle mesh.
+//
+
+#include "Adjacency.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+const uint32_t Adjacency::NO_EDGE;
+
+namespace {
+
+// Whether the bucket entry i is the first corner of its face in the bucket. A face that repeats
+// the vertex has its other corners right after it, and is seen from the first one only.
+bool isFirstCornerOfFace(const vector<uint32_t>& vertexCorners, uint32_t bucketStart, uint32_t i) {
+    return i == bucketStart || vertexCorners[i - 1] / 3 != vertexCorners[i] / 3;
+}
+
+// Calls visit(other) once for every distinct vertex of face above vertexNumber. A degenerate face
+// that repeats a vertex still adds one pair per edge.
+template <typename Visitor>
+void forEachHigherVertex(const Matrix3Xu& faces, uint32_t corner, long vertexNumber, Visitor visit) {
+    uint32_t face = corner / 3;
+    uint32_t next = faces((corner + 1) % 3, face);
+    uint32_t previous = faces((corner + 2) % 3, face);
+    if (next > vertexNumber) {
+        visit(next);
+    }
+    if (previous > vertexNumber && previous != next) {
+        visit(previous);
+    }
+}
+
+// (other vertex, face) for every edge of the faces around vertexNumber whose other vertex is
+// higher, sorted so the pairs of each edge are adjacent and in face order
+void collectHigherEdges(const Matrix3Xu& faces, const vector<uint32_t>& vertexCornerStart,
+                        const vector<uint32_t>& vertexCorners, long vertexNumber,
+                        vector<pair<uint32_t, uint32_t>>& edgeFaces) {
+    edgeFaces.clear();
+    uint32_t start = vertexCornerStart[vertexNumber];
+    for (uint32_t i = start; i < vertexCornerStart[vertexNumber + 1]; i++) {
+        if (!isFirstCornerOfFace(vertexCorners, start, i)) {
+            continue;
+        }
+        uint32_t face = vertexCorners[i] / 3;
+        forEachHigherVertex(faces, vertexCorners[i], vertexNumber, [&](uint32_t other) {
+            edgeFaces.push_back(make_pair(other, face));
+        });
+    }
+    sort(edgeFaces.begin(), edgeFaces.end());
+}
+
+}
+
+Adjacency::Adjacency(const Matrix3Xu& faces, long numVertices, ThreadPool* pool) {
+    bucketCornersByVertex(faces, numVertices, vertexCornerStart, vertexCorners);
+
+    // Every edge is owned by its lower vertex, which writes the (edge, face) pairs of its higher
+    // neighbours. Counting them first fixes where each vertex writes.
+    vector<uint32_t> firstEdgeFace(numVertices + 1, 0);
+    ThreadPool::parallelFor(pool, numVertices, 4096, [&](long first, long last) {
+        for (long vertexNumber = first; vertexNumber < last; vertexNumber++) {
+            uint32_t count = 0;
+            uint32_t start = vertexCornerStart[vertexNumber];
+            for (uint32_t i = start; i < vertexCornerStart[vertexNumber + 1]; i++) {
+                if (isFirstCornerOfFace(vertexCorners, start, i)) {
+                    forEachHigherVertex(faces, vertexCorners[i], vertexNumber, [&](uint32_t) { count++; });
+                }
+            }
+            firstEdgeFace[vertexNumber + 1] = count;
+        }
+    });
+    for (long vertexNumber = 0; vertexNumber < numVertices; vertexNumber++) {
+        firstEdgeFace[vertexNumber + 1] += firstEdgeFace[vertexNumber];
+    }
+
+    // Sort the pairs of every vertex by neighbour so the pairs of one edge are adjacent, and
+    // count the distinct neighbours, which are the edges the vertex owns
+    edgeFaces.resize(firstEdgeFace[numVertices]);
+    vector<uint32_t> edgeOthers(edgeFaces.size());
+    vector<uint32_t> firstEdge(numVertices + 1, 0);
+    ThreadPool::parallelFor(pool, numVertices, 4096, [&](long first, long last) {
+        vector<pair<uint32_t, uint32_t>> higherEdges;
+        for (long vertexNumber = first; vertexNumber < last; vertexNumber++) {
+            collectHigherEdges(faces, vertexCornerStart, vertexCorners, vertexNumber, higherEdges);
+            uint32_t numEdges = 0;
+            for (size_t i = 0; i < higherEdges.size(); i++) {
+                if (i == 0 || higherEdges[i].first != higherEdges[i - 1].first) numEdges++;
+                edgeOthers[firstEdgeFace[vertexNumber] + i] = higherEdges[i].first;
+                edgeFaces[firstEdgeFace[vertexNumber] + i] = higherEdges[i].second;
+            }
+            firstEdge[vertexNumber + 1] = numEdges;
+        }
+    });
+    for (long vertexNumber = 0; vertexNumber < numVertices; vertexNumber++) {
+        firstEdge[vertexNumber + 1] += firstEdge[vertexNumber];
+    }
+
+    const long numEdges = firstEdge[numVertices];
+    edges.resize(2, numEdges);
+    edgeFaceStart.resize(numEdges + 1);
+    edgeFaceStart[numEdges] = (uint32_t) edgeFaces.size();
+    faceEdges.setConstant(3, faces.cols(), NO_EDGE);
+
+    // Number the edges. Each (edge, face) pair belongs to one vertex only, so the writes never overlap.
+    ThreadPool::parallelFor(pool, numVertices, 4096, [&](long first, long last) {
+        for (long vertexNumber = first; vertexNumber < last; vertexNumber++) {
+            uint32_t edge = firstEdge[vertexNumber] - 1;
+            for (uint32_t i = firstEdgeFace[vertexNumber]; i < firstEdgeFace[vertexNumber + 1]; i++) {
+                uint32_t other = edgeOthers[i];
+                uint32_t face = edgeFaces[i];
+                if (i == firstEdgeFace[vertexNumber] || other != edgeOthers[i - 1]) {
+                    edge++;
+                    edges(0, edge) = (uint32_t) vertexNumber;
+                    edges(1, edge) = other;
+                    edgeFaceStart[edge] = i;
+                }
+                for (int side = 0; side < 3; side++) {
+                    uint32_t a = faces(side, face), b = faces((side + 1) % 3, face);
+                    if ((a == vertexNumber && b == other) || (a == other && b == vertexNumber)) {
+                        faceEdges(side, face) = edge;
+                    }
+                }
+            }
+        }
+    });
+}
+
+void Adjacency::bucketCornersByVertex(const Matrix3Xu& faces, long numVertices,
+                                      vector<uint32_t>& start, vector<uint32_t>& corners) {
+    // Counting sort, filling the buckets in corner order keeps every bucket in face order
+    const uint32_t* cornerVertices = faces.data();
+    start.assign(numVertices + 1, 0);
+    for (long corner = 0; corner < faces.size(); corner++) {
+        start[cornerVertices[corner] + 1]++;
+    }
+    for (long vertexNumber = 0; vertexNumber < numVertices; vertexNumber++) {
+        start[vertexNumber + 1] += start[vertexNumber];
+    }
+    vector<uint32_t> end(start.begin(), start.end() - 1);
+    corners.resize(faces.size());
+    for (long corner = 0; corner < faces.size(); corner++) {
+        corners[end[cornerVertices[corner]]++] = (uint32_t) corner;
+    }
+}
+
+long Adjacency::getNumVertices() const {
+    return (long) vertexCornerStart.size() - 1;
+}
+
+long Adjacency::getNumEdges() const {
+    return edges.cols();
+}
+
+const uint32_t* Adjacency::beginVertexCorners(long vertexNumber) const {
+    return vertexCorners.data() + vertexCornerStart[vertexNumber];
+}
+
+const uint32_t* Adjacency::endVertexCorners(long vertexNumber) const {
+    return vertexCorners.data() + vertexCornerStart[vertexNumber + 1];
+}
+
+void Adjacency::getOneRing(long vertexNumber, vector<uint32_t>& neighbours) const {
+    neighbours.clear();
+    for (const uint32_t* corner = beginVertexCorners(vertexNumber); corner != endVertexCorners(vertexNumber); corner++) {
+        uint32_t face = *corner / 3;
+        for (int side = 0; side < 3; side++) {
+            uint32_t edge = faceEdges(side, face);
+            if (edge == NO_EDGE) {
+                continue;
+            }
+            if (edges(0, edge) == vertexNumber) {
+                neighbours.push_back(edges(1, edge));
+            } else if (edges(1, edge) == vertexNumber) {
+                neighbours.push_back(edges(0, edge));
+            }
+        }
+    }
+    sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(unique(neighbours.begin(), neighbours.end()), neighbours.end());
+}
+
+const Adjacency::Matrix2Xu& Adjacency::getEdges() const {
+    return edges;
+}
+
+const uint32_t* Adjacency::beginEdgeFaces(long edgeNumber) const {
+    return edgeFaces.data() + edgeFaceStart[edgeNumber];
+}
+
+const uint32_t* Adjacency::endEdgeFaces(long edgeNumber) const {
+    return edgeFaces.data() + edgeFaceStart[edgeNumber + 1];
+}
+
+bool Adjacency::isBoundaryEdge(long edgeNumber) const {
+    return edgeFaceStart[edgeNumber + 1] - edgeFaceStart[edgeNumber] == 1;
+}
+
+const Matrix3Xu& Adjacency::getFaceEdges() const {
+    return faceEdges;
+}
+
+size_t Adjacency::getMemoryUsage() const {
+    return sizeof(uint32_t) * (vertexCornerStart.size() + vertexCorners.size() + edges.size()
+            + edgeFaceStart.size() + edgeFaces.size() + faceEdges.size());
+}
@@ -0,0 +1,64 @@
+//
+// Compact vertex, edge and face adjacency of an indexed triangle mesh.
+//
+
+#ifndef UNTITLED_ADJACENCY_H
+#define UNTITLED_ADJACENCY_H
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+#include "ThreadPool.h"
+#include "Utils.h"
+
+// All relations are stored as CSR arrays: the items of element i are items[start[i]] up to
+// items[start[i + 1]]. Corner c is corner c % 3 of face c / 3, which is where faces.data()
+// keeps its vertex. Edges are unique, sorted by their lower and then their higher vertex.
+class Adjacency {
+public:
+    typedef Eigen::Matrix<uint32_t, 2, Eigen::Dynamic> Matrix2Xu;
+
+    // Face edge of a degenerate side whose corners share a vertex
+    static const uint32_t NO_EDGE = UINT32_MAX;
+
+private:
+    std::vector<uint32_t> vertexCornerStart;
+    std::vector<uint32_t> vertexCorners;
+    Matrix2Xu edges;
+    std::vector<uint32_t> edgeFaceStart;
+    std::vector<uint32_t> edgeFaces;
+    Matrix3Xu faceEdges;
+
+public:
+    // The corner buckets are built by a counting sort, the edges are found and written per
+    // vertex in parallel with a pool. The result does not depend on the pool.
+    Adjacency(const Matrix3Xu& faces, long numVertices, ThreadPool* pool = nullptr);
+
+    // Buckets the corners of faces by vertex. Every bucket lists its corners in face order.
+    static void bucketCornersByVertex(const Matrix3Xu& faces, long numVertices,
+            std::vector<uint32_t>& start, std::vector<uint32_t>& corners);
+
+    long getNumVertices() const;
+    long getNumEdges() const;
+
+    // Corners that use the vertex, in face order
+    const uint32_t* beginVertexCorners(long vertexNumber) const;
+    const uint32_t* endVertexCorners(long vertexNumber) const;
+    // Vertices that share an edge with the vertex, in ascending order
+    void getOneRing(long vertexNumber, std::vector<uint32_t>& neighbours) const;
+
+    // Both vertices of every edge, lower vertex first
+    const Matrix2Xu& getEdges() const;
+    // Faces on either side of the edge, one for boundary edges and more for non-manifold ones
+    const uint32_t* beginEdgeFaces(long edgeNumber) const;
+    const uint32_t* endEdgeFaces(long edgeNumber) const;
+    bool isBoundaryEdge(long edgeNumber) const;
+    // Edge k of every face joins its corners k and (k + 1) % 3, or is NO_EDGE
+    const Matrix3Xu& getFaceEdges() const;
+
+    // Bytes held by the arrays
+    size_t getMemoryUsage() const;
+};
+
+
+#endif //UNTITLED_ADJACENCY_H
@@ -0,0 +1,18 @@
+//
+// Counts heap allocations of the whole program when it is built with COUNT_ALLOCATIONS.
+//
+
+#ifndef UNTITLED_ALLOCATIONCOUNTER_H
+#define UNTITLED_ALLOCATIONCOUNTER_H
+
+// With COUNT_ALLOCATIONS defined the global operator new is replaced by one that counts every
+// call, on any thread, before allocating as usual. Without it nothing is replaced and the
+// count stays 0.
+class AllocationCounter {
+public:
+    // Calls of operator new since the program started
+    static long getCount();
+};
+
+
+#endif //UNTITLED_ALLOCATIONCOUNTER_H
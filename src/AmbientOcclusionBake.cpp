@@ -0,0 +1,170 @@
+//
+// Bakes per vertex ambient occlusion of a Geometry by casting rays against its hierarchy.
+//
+
+#include "AmbientOcclusionBake.h"
+
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+using namespace Eigen;
+using namespace std;
+
+const float AmbientOcclusionBake::MAX_DISTANCE = 0.25f;
+
+namespace {
+
+// Vertices per step before the bake has measured its own speed, and per range of the pool
+const long MIN_BATCH_VERTICES = 256;
+const long GRAIN_VERTICES = 16;
+
+}
+
+AmbientOcclusionBake::AmbientOcclusionBake(const shared_ptr<const Geometry>& geometry, int raysPerVertex)
+        : geometry(geometry), raysPerVertex(max(1, raysPerVertex)), cancelled(false) {
+    // Points spread evenly over the unit disc by the golden angle, lifted onto the hemisphere,
+    // which gives directions with a density proportional to the cosine
+    const float goldenAngle = (float) (M_PI * (3 - sqrt(5.0)));
+    directions.resize(3, this->raysPerVertex);
+    for (int ray = 0; ray < this->raysPerVertex; ray++) {
+        float radius = sqrt((ray + 0.5f) / this->raysPerVertex);
+        float angle = ray * goldenAngle;
+        directions.col(ray) << radius * cos(angle), radius * sin(angle), sqrt(max(0.0f, 1 - radius * radius));
+    }
+
+    float diagonal = (geometry->getBoundsMax() - geometry->getBoundsMin()).norm();
+    maxDistance = MAX_DISTANCE * diagonal;
+    // Lifts the rays off the surface they start on
+    bias = 1e-4f * diagonal;
+    ambientOcclusion = make_shared<RowVectorXf>(RowVectorXf::Ones(geometry->getVertices().cols()));
+}
+
+float AmbientOcclusionBake::bakeVertex(long vertex, long& numRays) const {
+    const Matrix3Xf& vertices = geometry->getVertices();
+    const Matrix3Xu& faces = geometry->getFaces();
+    const Bvh& bvh = geometry->getBvh();
+    const TriangleBlocks& triangleBlocks = geometry->getTriangleBlocks();
+    Vector3f normal = geometry->getVertexNormals().col(vertex);
+    if (normal.squaredNorm() == 0) {
+        // Not used by any face
+        return 1;
+    }
+
+    // Tangent frame around the normal without a branch on its direction (Duff et al. 2017)
+    float sign = copysign(1.0f, normal(2));
+    float a = -1 / (sign + normal(2));
+    float b = normal(0) * normal(1) * a;
+    Vector3f tangent(1 + sign * normal(0) * normal(0) * a, sign * b, -sign * normal(0));
+    Vector3f bitangent(b, sign + normal(1) * normal(1) * a, -normal(1));
+    // Neighbouring vertices turn the directions by unrelated angles, which breaks up banding
+    float turn = (float) (2 * M_PI * fmod(vertex * 0.6180339887, 1.0));
+    float turnCos = cos(turn), turnSin = sin(turn);
+
+    Vector3f origin = vertices.col(vertex) + bias * normal;
+    int numOpen = 0;
+    for (int ray = 0; ray < raysPerVertex; ray++) {
+        float x = turnCos * directions(0, ray) - turnSin * directions(1, ray);
+        float y = turnSin * directions(0, ray) + turnCos * directions(1, ray);
+        Vector3f direction = x * tangent + y * bitangent + directions(2, ray) * normal;
+
+        // Any hit will do, so the first one ends the traversal
+        float tMax = maxDistance;
+        bvh.traverseLeaves(origin, direction, tMax, [&](uint32_t nodeIndex) {
+            triangleBlocks.forEachHit(nodeIndex, origin, direction, 0.0f, tMax, [&](uint32_t face, float t) {
+                if (faces(0, face) != vertex && faces(1, face) != vertex && faces(2, face) != vertex) {
+                    tMax = -1;
+                }
+            });
+        });
+        if (tMax > 0) {
+            numOpen++;
+        }
+    }
+    numRays += raysPerVertex;
+    return (float) numOpen / raysPerVertex;
+}
+
+bool AmbientOcclusionBake::step(double milliseconds, ThreadPool* pool) {
+    const long numVertices = geometry->getVertices().cols();
+    auto start = chrono::steady_clock::now();
+    double elapsed = 0;
+    while (nextVertex < numVertices && !cancelled) {
+        // As many vertices as fit into the time that is left at the speed so far
+        long batch = MIN_BATCH_VERTICES;
+        if (seconds > 0) {
+            double fit = nextVertex / seconds * (milliseconds - elapsed) / 1000;
+            batch = fit >= numVertices - nextVertex ? numVertices : max(batch, (long) fit);
+        }
+        batch = min(batch, numVertices - nextVertex);
+
+        const long firstVertex = nextVertex;
+        atomic<long> batchRays(0);
+        auto batchStart = chrono::steady_clock::now();
+        ThreadPool::parallelFor(pool, batch, GRAIN_VERTICES, [&](long begin, long end) {
+            long rangeRays = 0;
+            for (long i = begin; i < end && !cancelled; i++) {
+                (*ambientOcclusion)(firstVertex + i) = bakeVertex(firstVertex + i, rangeRays);
+            }
+            batchRays += rangeRays;
+        });
+        auto batchEnd = chrono::steady_clock::now();
+        nextVertex += batch;
+        numRays += batchRays;
+        seconds += chrono::duration<double>(batchEnd - batchStart).count();
+
+        if (nextVertex == numVertices && !cancelled) {
+            geometry->setAmbientOcclusion(ambientOcclusion);
+        }
+        elapsed = chrono::duration<double, milli>(batchEnd - start).count();
+        if (elapsed >= milliseconds) {
+            break;
+        }
+    }
+    if (numVertices == 0 && !cancelled) {
+        geometry->setAmbientOcclusion(ambientOcclusion);
+    }
+    return isDone();
+}
+
+bool AmbientOcclusionBake::run(ThreadPool* pool) {
+    while (!isDone() && !cancelled) {
+        step(numeric_limits<double>::infinity(), pool);
+    }
+    return isDone();
+}
+
+void AmbientOcclusionBake::cancel() {
+    cancelled = true;
+}
+
+bool AmbientOcclusionBake::isDone() const {
+    return nextVertex == geometry->getVertices().cols() && !cancelled;
+}
+
+bool AmbientOcclusionBake::isCancelled() const {
+    return cancelled;
+}
+
+float AmbientOcclusionBake::getProgress() const {
+    long numVertices = geometry->getVertices().cols();
+    return numVertices == 0 ? 1.0f : (float) nextVertex / numVertices;
+}
+
+const shared_ptr<const Geometry>& AmbientOcclusionBake::getGeometry() const {
+    return geometry;
+}
+
+long AmbientOcclusionBake::getNumRays() const {
+    return numRays;
+}
+
+double AmbientOcclusionBake::getSeconds() const {
+    return seconds;
+}
+
+double AmbientOcclusionBake::getRaysPerSecond() const {
+    return seconds > 0 ? numRays / seconds : 0;
+}
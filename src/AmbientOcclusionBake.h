@@ -0,0 +1,63 @@
+//
+// Bakes per vertex ambient occlusion of a Geometry by casting rays against its hierarchy.
+//
+
+#ifndef UNTITLED_AMBIENTOCCLUSIONBAKE_H
+#define UNTITLED_AMBIENTOCCLUSIONBAKE_H
+
+#include <Eigen/Core>
+#include <atomic>
+#include <memory>
+#include "Geometry.h"
+#include "ThreadPool.h"
+
+// Every vertex casts the same cosine weighted set of directions over the hemisphere around its
+// normal, turned by an angle derived from the vertex index, and counts the rays that leave the
+// mesh within a fraction of its size. The result does not depend on the pool or on how the bake
+// is split into steps, so the editor can run a few milliseconds of it per frame.
+class AmbientOcclusionBake {
+public:
+    static const int DEFAULT_RAYS_PER_VERTEX = 64;
+    // Rays further than this fraction of the diagonal of the bounds do not occlude
+    static const float MAX_DISTANCE;
+
+private:
+    std::shared_ptr<const Geometry> geometry;
+    int raysPerVertex;
+    // Hemisphere directions around +z
+    Eigen::Matrix3Xf directions;
+    float maxDistance;
+    float bias;
+
+    std::shared_ptr<RowVectorXf> ambientOcclusion;
+    long nextVertex = 0;
+    std::atomic<bool> cancelled;
+    long numRays = 0;
+    double seconds = 0;
+
+    float bakeVertex(long vertex, long& numRays) const;
+
+public:
+    explicit AmbientOcclusionBake(const std::shared_ptr<const Geometry>& geometry,
+                                  int raysPerVertex = DEFAULT_RAYS_PER_VERTEX);
+
+    // Bakes further vertices on pool for about the given time. Returns true once every vertex
+    // is done, the result is then stored in the geometry.
+    bool step(double milliseconds, ThreadPool* pool = nullptr);
+    // Bakes all remaining vertices, returns false if the bake was cancelled
+    bool run(ThreadPool* pool = nullptr);
+    // Safe to call from any thread, a running step stops within a few vertices
+    void cancel();
+
+    bool isDone() const;
+    bool isCancelled() const;
+    float getProgress() const;
+    const std::shared_ptr<const Geometry>& getGeometry() const;
+
+    long getNumRays() const;
+    double getSeconds() const;
+    double getRaysPerSecond() const;
+};
+
+
+#endif //UNTITLED_AMBIENTOCCLUSIONBAKE_H
@@ -0,0 +1,84 @@
+//
+// Registry that hands out one shared Geometry per asset.
+//
+
+#include "AssetRegistry.h"
+#include "Utils.h"
+
+std::shared_ptr<const Geometry> AssetRegistry::findLocked(const std::string& filePath, uint64_t sourceSize,
+                                                          int64_t sourceModifiedTime) {
+    auto entry = byPath.find(filePath);
+    if (entry == byPath.end() || entry->second.sourceSize != sourceSize
+            || entry->second.sourceModifiedTime != sourceModifiedTime) {
+        return nullptr;
+    }
+    return entry->second.geometry.lock();
+}
+
+std::shared_ptr<const Geometry> AssetRegistry::find(const std::string& filePath) {
+    uint64_t sourceSize;
+    int64_t sourceModifiedTime;
+    if (!Utils::getFileStamp(filePath, sourceSize, sourceModifiedTime)) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    return findLocked(filePath, sourceSize, sourceModifiedTime);
+}
+
+std::shared_ptr<const Geometry> AssetRegistry::load(const std::string& filePath,
+                                                    const OffParser::ProgressCallback& onProgress) {
+    uint64_t sourceSize = 0;
+    int64_t sourceModifiedTime = 0;
+    Utils::getFileStamp(filePath, sourceSize, sourceModifiedTime);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        PathEntry& entry = byPath[filePath];
+        loadFinished.wait(lock, [&entry]() { return !entry.loading; });
+        std::shared_ptr<const Geometry> geometry = findLocked(filePath, sourceSize, sourceModifiedTime);
+        if (geometry) {
+            return geometry;
+        }
+        entry.loading = true;
+    }
+
+    std::shared_ptr<const Geometry> geometry;
+    try {
+        geometry = Geometry::fromOffFile(filePath, onProgress);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        byPath[filePath].loading = false;
+        loadFinished.notify_all();
+        throw;
+    }
+    if (geometry) {
+        geometry = intern(geometry);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    PathEntry& entry = byPath[filePath];
+    entry.loading = false;
+    if (geometry) {
+        entry.geometry = geometry;
+        entry.sourceSize = sourceSize;
+        entry.sourceModifiedTime = sourceModifiedTime;
+    }
+    loadFinished.notify_all();
+    return geometry;
+}
+
+std::shared_ptr<const Geometry> AssetRegistry::intern(const std::shared_ptr<const Geometry>& geometry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::weak_ptr<const Geometry>& registered = byContent[geometry->getContentHash()];
+    std::shared_ptr<const Geometry> existing = registered.lock();
+    if (existing && existing->getVertices() == geometry->getVertices() && existing->getFaces() == geometry->getFaces()) {
+        return existing;
+    }
+    registered = geometry;
+    return geometry;
+}
+
+AssetRegistry& AssetRegistry::shared() {
+    static AssetRegistry registry;
+    return registry;
+}
@@ -0,0 +1,53 @@
+//
+// Registry that hands out one shared Geometry per asset.
+//
+
+#ifndef UNTITLED_ASSETREGISTRY_H
+#define UNTITLED_ASSETREGISTRY_H
+
+#include "Geometry.h"
+#include "OffParser.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Geometry is looked up by file path first and then by content hash, so the same file is
+// parsed once and identical files under different paths share one copy as well. The registry
+// only holds weak references: geometry is freed when its last Mesh goes away.
+class AssetRegistry {
+private:
+    struct PathEntry {
+        std::weak_ptr<const Geometry> geometry;
+        uint64_t sourceSize = 0;
+        int64_t sourceModifiedTime = 0;
+        bool loading = false;
+    };
+
+    std::mutex mutex;
+    std::condition_variable loadFinished;
+    std::unordered_map<std::string, PathEntry> byPath;
+    std::unordered_map<uint64_t, std::weak_ptr<const Geometry>> byContent;
+
+    std::shared_ptr<const Geometry> findLocked(const std::string& filePath, uint64_t sourceSize,
+            int64_t sourceModifiedTime);
+
+public:
+    // Returns the registered geometry of the file if it is loaded and the file has not changed since
+    std::shared_ptr<const Geometry> find(const std::string& filePath);
+
+    // Returns the registered geometry of the file, loading it if needed. Concurrent loads of the
+    // same file wait for the first one. Returns null if onProgress cancelled the load.
+    std::shared_ptr<const Geometry> load(const std::string& filePath,
+            const OffParser::ProgressCallback& onProgress = OffParser::ProgressCallback());
+
+    // Returns the registered geometry with the same content, or registers this one
+    std::shared_ptr<const Geometry> intern(const std::shared_ptr<const Geometry>& geometry);
+
+    static AssetRegistry& shared();
+};
+
+
+#endif //UNTITLED_ASSETREGISTRY_H
@@ -0,0 +1,291 @@
+//
+// Bounding volume hierarchy over the triangles of a geometry or the instances of a scene, used
+// for ray queries.
+//
+
+#include "Bvh.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace Eigen;
+using namespace std;
+
+namespace {
+
+// Above this many items a leaf is split even when the heuristic does not find it worthwhile
+const int MAX_UNSPLIT_LEAF_SIZE = 32;
+
+struct Bounds {
+    Vector3f min = Vector3f::Constant(numeric_limits<float>::infinity());
+    Vector3f max = Vector3f::Constant(-numeric_limits<float>::infinity());
+
+    void grow(const Vector3f& pointMin, const Vector3f& pointMax) {
+        min = min.cwiseMin(pointMin);
+        max = max.cwiseMax(pointMax);
+    }
+
+    void grow(const Bounds& other) {
+        grow(other.min, other.max);
+    }
+
+    // Half the surface area, which is all the heuristic needs
+    float halfArea() const {
+        Vector3f extent = (max - min).cwiseMax(0.0f);
+        return extent(0) * extent(1) + extent(1) * extent(2) + extent(2) * extent(0);
+    }
+};
+
+struct Bin {
+    Bounds bounds;
+    long count = 0;
+};
+
+// Build time copy of an item, partitioned in place so every node reads a contiguous range
+struct BuildItem {
+    Vector3f boundsMin;
+    Vector3f boundsMax;
+    Vector3f centroid;
+    uint32_t item;
+};
+
+struct BuildTask {
+    uint32_t parent;
+    bool isRightChild;
+    long begin;
+    long end;
+    int depth;
+    Bounds bounds;
+};
+
+// Fills nodes and itemOrder, reordering buildItems into leaf order
+void build(vector<BuildItem>& buildItems, int maxLeafSize, vector<Bvh::Node>& nodes, vector<uint32_t>& itemOrder) {
+    const long numItems = (long) buildItems.size();
+    if (numItems == 0) {
+        return;
+    }
+    if (numItems > Bvh::MAX_ITEMS) {
+        throw runtime_error("Too many items for a bounding volume hierarchy");
+    }
+    Bounds rootBounds;
+    for (const BuildItem& buildItem : buildItems) {
+        rootBounds.grow(buildItem.boundsMin, buildItem.boundsMax);
+    }
+    nodes.reserve(2 * numItems / maxLeafSize + 1);
+
+    // Right children are pushed first, so every left child is built right after its parent.
+    // The bounds of a child are known from the bins that chose its split.
+    vector<BuildTask> tasks;
+    BuildTask root;
+    root.parent = 0;
+    root.isRightChild = false;
+    root.begin = 0;
+    root.end = numItems;
+    root.depth = 0;
+    root.bounds = rootBounds;
+    tasks.push_back(root);
+    while (!tasks.empty()) {
+        BuildTask task = tasks.back();
+        tasks.pop_back();
+
+        uint32_t nodeIndex = (uint32_t) nodes.size();
+        nodes.push_back(Bvh::Node());
+        if (task.isRightChild) {
+            nodes[task.parent].offset = nodeIndex;
+        }
+        Bvh::Node& node = nodes[nodeIndex];
+        for (int axis = 0; axis < 3; axis++) {
+            node.boundsMin[axis] = task.bounds.min(axis);
+            node.boundsMax[axis] = task.bounds.max(axis);
+        }
+        const long count = task.end - task.begin;
+
+        // Bin the centroids along all three axes in one pass and find the cheapest split between bins
+        int bestAxis = -1, bestBin = 0;
+        float bestCost = numeric_limits<float>::infinity();
+        Bounds bestLeft, bestRight;
+        Bounds centroidBounds;
+        if (count > maxLeafSize) {
+            for (long i = task.begin; i < task.end; i++) {
+                centroidBounds.grow(buildItems[i].centroid, buildItems[i].centroid);
+            }
+            Vector3f extent = centroidBounds.max - centroidBounds.min;
+            Vector3f binScale;
+            for (int axis = 0; axis < 3; axis++) {
+                binScale(axis) = extent(axis) > 0.0f ? Bvh::NUM_BINS / extent(axis) : 0.0f;
+            }
+            Bin bins[3][Bvh::NUM_BINS];
+            for (long i = task.begin; i < task.end; i++) {
+                const BuildItem& buildItem = buildItems[i];
+                for (int axis = 0; axis < 3; axis++) {
+                    int bin = min(Bvh::NUM_BINS - 1, (int) ((buildItem.centroid(axis) - centroidBounds.min(axis)) * binScale(axis)));
+                    bins[axis][bin].count++;
+                    bins[axis][bin].bounds.grow(buildItem.boundsMin, buildItem.boundsMax);
+                }
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                if (extent(axis) <= 0.0f) {
+                    continue;
+                }
+                Bounds rightBounds[Bvh::NUM_BINS];
+                long rightCounts[Bvh::NUM_BINS];
+                Bounds right;
+                long rightCount = 0;
+                for (int bin = Bvh::NUM_BINS - 1; bin > 0; bin--) {
+                    right.grow(bins[axis][bin].bounds);
+                    rightCount += bins[axis][bin].count;
+                    rightBounds[bin] = right;
+                    rightCounts[bin] = rightCount;
+                }
+                Bounds left;
+                long leftCount = 0;
+                for (int bin = 0; bin < Bvh::NUM_BINS - 1; bin++) {
+                    left.grow(bins[axis][bin].bounds);
+                    leftCount += bins[axis][bin].count;
+                    if (leftCount == 0 || rightCounts[bin + 1] == 0) {
+                        continue;
+                    }
+                    float cost = left.halfArea() * leftCount + rightBounds[bin + 1].halfArea() * rightCounts[bin + 1];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestBin = bin;
+                        bestLeft = left;
+                        bestRight = rightBounds[bin + 1];
+                    }
+                }
+            }
+        }
+
+        // Intersecting an item is taken to cost as much as visiting a node. The depth limit bounds
+        // the traversal stack and is only reached by pathological inputs, whose leaves at the limit
+        // may then hold any number of items.
+        float leafCost = task.bounds.halfArea() * count;
+        bool makeLeaf = count <= maxLeafSize || (bestCost >= leafCost && count <= MAX_UNSPLIT_LEAF_SIZE)
+                || task.depth >= Bvh::MAX_DEPTH - 1;
+        if (makeLeaf) {
+            node.offset = (uint32_t) task.begin;
+            node.count = (uint32_t) count;
+            node.axis = 0;
+            continue;
+        }
+
+        long middle;
+        if (bestAxis >= 0) {
+            float binScale = Bvh::NUM_BINS / (centroidBounds.max(bestAxis) - centroidBounds.min(bestAxis));
+            float axisMin = centroidBounds.min(bestAxis);
+            middle = partition(buildItems.begin() + task.begin, buildItems.begin() + task.end, [&](const BuildItem& buildItem) {
+                return min(Bvh::NUM_BINS - 1, (int) ((buildItem.centroid(bestAxis) - axisMin) * binScale)) <= bestBin;
+            }) - buildItems.begin();
+        } else {
+            // All centroids coincide, split the range in half
+            middle = task.begin + count / 2;
+            for (long i = task.begin; i < task.end; i++) {
+                (i < middle ? bestLeft : bestRight).grow(buildItems[i].boundsMin, buildItems[i].boundsMax);
+            }
+        }
+
+        node.count = 0;
+        node.axis = (uint32_t) max(0, bestAxis);
+        BuildTask leftTask = task, rightTask = task;
+        leftTask.parent = rightTask.parent = nodeIndex;
+        leftTask.depth = rightTask.depth = task.depth + 1;
+        leftTask.isRightChild = false;
+        leftTask.end = middle;
+        leftTask.bounds = bestLeft;
+        rightTask.isRightChild = true;
+        rightTask.begin = middle;
+        rightTask.bounds = bestRight;
+        tasks.push_back(rightTask);
+        tasks.push_back(leftTask);
+    }
+
+    itemOrder.resize(numItems);
+    for (long i = 0; i < numItems; i++) {
+        itemOrder[i] = buildItems[i].item;
+    }
+}
+
+}
+
+Bvh::Bvh(const Matrix3Xu& faces, const Matrix3Xf& vertices) {
+    const long numFaces = faces.cols();
+    vector<BuildItem> buildItems(numFaces);
+    for (long faceNumber = 0; faceNumber < numFaces; faceNumber++) {
+        Vector3f a = vertices.col(faces(0, faceNumber));
+        Vector3f b = vertices.col(faces(1, faceNumber));
+        Vector3f c = vertices.col(faces(2, faceNumber));
+        BuildItem& buildItem = buildItems[faceNumber];
+        buildItem.boundsMin = a.cwiseMin(b).cwiseMin(c);
+        buildItem.boundsMax = a.cwiseMax(b).cwiseMax(c);
+        buildItem.centroid = (a + b + c) / 3;
+        buildItem.item = (uint32_t) faceNumber;
+    }
+    build(buildItems, MAX_LEAF_SIZE, nodes, faceOrder);
+}
+
+Bvh::Bvh(const Matrix3Xf& itemBoundsMin, const Matrix3Xf& itemBoundsMax, int maxLeafSize) {
+    const long numItems = itemBoundsMin.cols();
+    vector<BuildItem> buildItems(numItems);
+    for (long item = 0; item < numItems; item++) {
+        BuildItem& buildItem = buildItems[item];
+        buildItem.boundsMin = itemBoundsMin.col(item);
+        buildItem.boundsMax = itemBoundsMax.col(item);
+        buildItem.centroid = (buildItem.boundsMin + buildItem.boundsMax) / 2;
+        buildItem.item = (uint32_t) item;
+    }
+    build(buildItems, maxLeafSize, nodes, faceOrder);
+}
+
+void Bvh::refit(const Matrix3Xf& itemBoundsMin, const Matrix3Xf& itemBoundsMax, long item) {
+    if (parents.empty()) {
+        parents.assign(nodes.size(), UINT32_MAX);
+        itemLeaves.resize(faceOrder.size());
+        for (uint32_t nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++) {
+            const Node& node = nodes[nodeIndex];
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    itemLeaves[faceOrder[i]] = nodeIndex;
+                }
+            } else {
+                parents[nodeIndex + 1] = nodeIndex;
+                parents[node.offset] = nodeIndex;
+            }
+        }
+    }
+
+    uint32_t nodeIndex = itemLeaves[item];
+    while (nodeIndex != UINT32_MAX) {
+        Node& node = nodes[nodeIndex];
+        Bounds bounds;
+        if (node.count > 0) {
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                bounds.grow(itemBoundsMin.col(faceOrder[i]), itemBoundsMax.col(faceOrder[i]));
+            }
+        } else {
+            const Node& left = nodes[nodeIndex + 1];
+            const Node& right = nodes[node.offset];
+            bounds.grow(Map<const Vector3f>(left.boundsMin), Map<const Vector3f>(left.boundsMax));
+            bounds.grow(Map<const Vector3f>(right.boundsMin), Map<const Vector3f>(right.boundsMax));
+        }
+        // The nodes above only depend on this one through its box
+        if (Map<Vector3f>(node.boundsMin) == bounds.min && Map<Vector3f>(node.boundsMax) == bounds.max) {
+            break;
+        }
+        Map<Vector3f>(node.boundsMin) = bounds.min;
+        Map<Vector3f>(node.boundsMax) = bounds.max;
+        nodeIndex = parents[nodeIndex];
+    }
+}
+
+const vector<Bvh::Node>& Bvh::getNodes() const {
+    return nodes;
+}
+
+const vector<uint32_t>& Bvh::getFaceOrder() const {
+    return faceOrder;
+}
+
+size_t Bvh::getMemoryUsage() const {
+    return sizeof(Node) * nodes.size() + sizeof(uint32_t) * (faceOrder.size() + parents.size() + itemLeaves.size());
+}
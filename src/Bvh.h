@@ -0,0 +1,197 @@
+//
+// Bounding volume hierarchy over the triangles of a geometry or the instances of a scene, used
+// for ray queries.
+//
+
+#ifndef UNTITLED_BVH_H
+#define UNTITLED_BVH_H
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "Utils.h"
+
+// Closest intersection of a ray with a triangle. The hit point is
+// (1 - u - v) * a + u * b + v * c for the corners a, b and c of the face.
+struct RayHit {
+    float t = std::numeric_limits<float>::infinity();
+    uint32_t face = UINT32_MAX;
+    float u = 0;
+    float v = 0;
+};
+
+// Built top down with the surface area heuristic evaluated over a fixed number of bins per
+// axis, which keeps the build O(N log N). Nodes are stored depth first: the left child of an
+// interior node directly follows it and the node stores the index of its right child.
+// The items are triangles or any other boxes, and are identified by their column number.
+class Bvh {
+public:
+    struct Node {
+        float boundsMin[3];
+        float boundsMax[3];
+        // First entry of faceOrder for leaves, right child for interior nodes
+        uint32_t offset;
+        // Number of faces, zero for interior nodes. Wide enough for every item, so a leaf can
+        // always be made at the depth limit.
+        uint32_t count : 30;
+        // Split axis of interior nodes, used to visit the nearer child first
+        uint32_t axis : 2;
+    };
+
+    // How a box relates to a query region
+    enum Overlap {
+        DISJOINT,
+        OVERLAPPING,
+        CONTAINED
+    };
+
+    static const int MAX_LEAF_SIZE = 4;
+    static const int NUM_BINS = 16;
+    // Deeper subtrees are not split further, which bounds the traversal stack
+    static const int MAX_DEPTH = 128;
+    // Most items a hierarchy can hold, the limit of Node::count
+    static const long MAX_ITEMS = (1L << 30) - 1;
+
+private:
+    std::vector<Node> nodes;
+    std::vector<uint32_t> faceOrder;
+    // Only built by the first refit, hierarchies that never move do not pay for them
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> itemLeaves;
+
+public:
+    // Both constructors throw for more than MAX_ITEMS items
+    Bvh(const Matrix3Xu& faces, const Eigen::Matrix3Xf& vertices);
+    // Over the boxes of arbitrary items, with leaves of at most maxLeafSize items where the
+    // heuristic allows it
+    Bvh(const Eigen::Matrix3Xf& itemBoundsMin, const Eigen::Matrix3Xf& itemBoundsMax, int maxLeafSize = MAX_LEAF_SIZE);
+
+    // Whether the ray origin + t * direction enters the box of node with t in [0, tMax]
+    static bool intersectsBounds(const Node& node, const Eigen::Vector3f& origin,
+                                 const Eigen::Vector3f& inverseDirection, float tMax);
+
+    // Calls visitLeaf(nodeIndex) for every leaf whose box the ray origin + t * direction enters
+    // with t in [0, tMax], near children first. tMax is read again at every node, so a visitor
+    // that shrinks it to its closest hit prunes the rest of the traversal.
+    template <typename LeafVisitor>
+    void traverseLeaves(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, const float& tMax,
+                        LeafVisitor visitLeaf) const;
+
+    // Calls visitItem(item) for every item of the leaves of traverseLeaves
+    template <typename ItemVisitor>
+    void traverse(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, const float& tMax,
+                  ItemVisitor visitItem) const;
+
+    // Calls visitItem(item, contained) for every item in a leaf whose box classifyBounds(min, max)
+    // does not find DISJOINT. Below a CONTAINED node no more boxes are classified and contained
+    // is true. The walk stops early when visitItem returns false.
+    template <typename BoundsClassifier, typename ItemVisitor>
+    void query(BoundsClassifier classifyBounds, ItemVisitor visitItem) const;
+
+    // Grows or shrinks the leaf of one item to the item's new box and the nodes above it, which
+    // keeps the tree valid in O(depth) but not optimal. The boxes are those of all items.
+    void refit(const Eigen::Matrix3Xf& itemBoundsMin, const Eigen::Matrix3Xf& itemBoundsMax, long item);
+
+    const std::vector<Node>& getNodes() const;
+    // Faces or items in leaf order, leaves reference ranges of this
+    const std::vector<uint32_t>& getFaceOrder() const;
+    size_t getMemoryUsage() const;
+};
+
+inline bool Bvh::intersectsBounds(const Node& node, const Eigen::Vector3f& origin,
+                                  const Eigen::Vector3f& inverseDirection, float tMax) {
+    float tNear = 0.0f, tFar = tMax;
+    for (int axis = 0; axis < 3; axis++) {
+        float t0 = (node.boundsMin[axis] - origin(axis)) * inverseDirection(axis);
+        float t1 = (node.boundsMax[axis] - origin(axis)) * inverseDirection(axis);
+        if (t0 > t1) std::swap(t0, t1);
+        tNear = std::max(tNear, t0);
+        tFar = std::min(tFar, t1);
+    }
+    return tNear <= tFar;
+}
+
+template <typename LeafVisitor>
+void Bvh::traverseLeaves(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, const float& tMax,
+                         LeafVisitor visitLeaf) const {
+    if (nodes.empty()) {
+        return;
+    }
+    const Eigen::Vector3f inverseDirection = direction.cwiseInverse();
+
+    uint32_t stack[MAX_DEPTH + 2];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        uint32_t nodeIndex = stack[--stackSize];
+        const Node& node = nodes[nodeIndex];
+        if (!intersectsBounds(node, origin, inverseDirection, tMax)) {
+            continue;
+        }
+        if (node.count > 0) {
+            visitLeaf(nodeIndex);
+            continue;
+        }
+        // Push the far child first so the near one is visited first and shrinks tMax sooner
+        if (direction(node.axis) < 0) {
+            stack[stackSize++] = nodeIndex + 1;
+            stack[stackSize++] = node.offset;
+        } else {
+            stack[stackSize++] = node.offset;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+}
+
+template <typename ItemVisitor>
+void Bvh::traverse(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, const float& tMax,
+                   ItemVisitor visitItem) const {
+    traverseLeaves(origin, direction, tMax, [&](uint32_t nodeIndex) {
+        const Node& node = nodes[nodeIndex];
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+            visitItem(faceOrder[i]);
+        }
+    });
+}
+
+template <typename BoundsClassifier, typename ItemVisitor>
+void Bvh::query(BoundsClassifier classifyBounds, ItemVisitor visitItem) const {
+    if (nodes.empty()) {
+        return;
+    }
+    uint32_t stack[MAX_DEPTH + 2];
+    bool containedStack[MAX_DEPTH + 2];
+    int stackSize = 0;
+    stack[stackSize] = 0;
+    containedStack[stackSize++] = false;
+    while (stackSize > 0) {
+        stackSize--;
+        uint32_t nodeIndex = stack[stackSize];
+        bool contained = containedStack[stackSize];
+        const Node& node = nodes[nodeIndex];
+        if (!contained) {
+            Overlap overlap = classifyBounds(Eigen::Map<const Eigen::Vector3f>(node.boundsMin),
+                                             Eigen::Map<const Eigen::Vector3f>(node.boundsMax));
+            if (overlap == DISJOINT) {
+                continue;
+            }
+            contained = overlap == CONTAINED;
+        }
+        if (node.count > 0) {
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                if (!visitItem(faceOrder[i], contained)) {
+                    return;
+                }
+            }
+            continue;
+        }
+        stack[stackSize] = node.offset;
+        containedStack[stackSize++] = contained;
+        stack[stackSize] = nodeIndex + 1;
+        containedStack[stackSize++] = contained;
+    }
+}
+
+#endif //UNTITLED_BVH_H
@@ -46,31 +46,31 @@ void Camera::setFieldOfViewAngle(float fovAngle) {
     this->fieldOfViewAngle = fovAngle;
 }
 
-Vector3f Camera::getCameraPosition() {
+const Vector3f& Camera::getCameraPosition() const {
     return this->cameraPosition;
 }
 
-Vector3f Camera::getCameraTarget() {
+const Vector3f& Camera::getCameraTarget() const {
     return this->cameraTarget;
 }
 
-int Camera::getProjectionType() {
+int Camera::getProjectionType() const {
     return this->projectionType;
 }
 
-float Camera::getAspectRatio() {
+float Camera::getAspectRatio() const {
     return this->aspectRatio;
 }
 
-float Camera::getNear() {
+float Camera::getNear() const {
     return this->near;
 }
 
-float Camera::getFar() {
+float Camera::getFar() const {
     return this->far;
 }
 
-float Camera::getFieldOfViewAngle() {
+float Camera::getFieldOfViewAngle() const {
     return this->fieldOfViewAngle;
 }
 
@@ -120,7 +120,7 @@ void Camera::translateByAngleOnXAxis(float angle) {
     cameraPosition = cameraTarget + Vector3f(x, newY, newZ);
 }
 
-MatrixXf Camera::getView() {
+Matrix4f Camera::getView() const {
     Vector3f upVector(0., 1., 0.);
     Vector3f cameraDirection = (cameraPosition - cameraTarget).normalized();
     Vector3f cameraRight = (upVector.cross(cameraDirection).normalized());
@@ -142,7 +142,7 @@ MatrixXf Camera::getView() {
 
 }
 
-MatrixXf Camera::getProjection() {
+Matrix4f Camera::getProjection() const {
     float theta = this->fieldOfViewAngle;
 
 
@@ -163,7 +163,7 @@ MatrixXf Camera::getProjection() {
     l = -r;
 
     if (this->projectionType == PROJECTION_ORTHOGRAPHIC) {
-        Eigen::Matrix4f orthographic(4, 4);
+        Eigen::Matrix4f orthographic;
         orthographic <<
                      2 / (r - l), 0., 0., -(r + l) / (r - l),
                 0., 2 / (t - b), 0., -(t + b) / (t - b),
@@ -171,7 +171,7 @@ MatrixXf Camera::getProjection() {
                 0., 0., 0., 1.;
         return orthographic;
     } else if (this->projectionType == PROJECTION_PERSPECTIVE) {
-        Eigen::Matrix4f perspective(4, 4);
+        Eigen::Matrix4f perspective;
         perspective <<
                     2 * abs(n) / (r - l), 0., (r + l) / (r - l), 0.,
                 0., (2 * abs(n)) / (t - b), (t + b) / (t - b), 0.,
@@ -33,13 +33,13 @@ public:
     Camera(const Vector3f& cameraPosition, const Vector3f& cameraTarget, int projectionType,
             float aspectRatio, float near, float far, float fieldOfViewAngle);
 
-    Vector3f getCameraPosition();
-    Vector3f getCameraTarget();
-    int getProjectionType();
-    float getAspectRatio();
-    float getNear();
-    float getFar();
-    float getFieldOfViewAngle();
+    const Vector3f& getCameraPosition() const;
+    const Vector3f& getCameraTarget() const;
+    int getProjectionType() const;
+    float getAspectRatio() const;
+    float getNear() const;
+    float getFar() const;
+    float getFieldOfViewAngle() const;
 
     void setCameraPosition(const Vector3f& cameraPosition);
     void setCameraTarget(const Vector3f& target);
@@ -49,8 +49,8 @@ public:
     void setFar(float far);
     void setFieldOfViewAngle(float fovAngle);
 
-    MatrixXf getView();
-    MatrixXf getProjection();
+    Matrix4f getView() const;
+    Matrix4f getProjection() const;
 
     void translateBy(const Eigen::Vector3f& position);
     void translateByAngleOnYAxis(float angle);
@@ -0,0 +1,222 @@
+//
+// Immutable indexed triangle geometry shared by every Mesh instance of the same asset.
+//
+
+#include "Geometry.h"
+#include "MeshCache.h"
+#include "Utils.h"
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+Geometry::Geometry(const Matrix3Xf& vertices, const Matrix3Xu& faces) {
+    this->vertices = vertices;
+    this->faces = faces;
+    this->vertexNormals = calculateVertexNormals(faces, vertices, getAdjacency(), UNIFORM_WEIGHTING,
+            faces.cols() >= PARALLEL_FACES ? &ThreadPool::shared() : nullptr);
+    calculateBounds(vertices, this->boundsMin, this->boundsMax);
+    this->contentHash = calculateContentHash(vertices, faces);
+}
+
+Geometry::Geometry(const Matrix3Xf& vertices, const Matrix3Xu& faces, const Matrix3Xf& vertexNormals,
+                   const Vector3f& boundsMin, const Vector3f& boundsMax) {
+    this->vertices = vertices;
+    this->faces = faces;
+    this->vertexNormals = vertexNormals;
+    this->boundsMin = boundsMin;
+    this->boundsMax = boundsMax;
+    this->contentHash = calculateContentHash(vertices, faces);
+}
+
+shared_ptr<const Geometry> Geometry::fromOffFile(const string& filePath, const OffParser::ProgressCallback& onProgress) {
+    shared_ptr<const Geometry> geometry = MeshCache::read(filePath);
+    if (geometry) {
+        return geometry;
+    }
+
+    Matrix3Xf vertices;
+    Matrix3Xu faces;
+    if (!OffParser::parseFile(filePath, vertices, faces, onProgress)) {
+        return nullptr;
+    }
+
+    Vector3f baryCenter = calculateBarycenter(faces, vertices);
+    vertices.colwise() -= baryCenter;
+    shared_ptr<Geometry> parsed = make_shared<Geometry>(vertices, faces);
+    parsed->sourcePath = filePath;
+    MeshCache::write(filePath, *parsed);
+    return parsed;
+}
+
+shared_ptr<const Geometry> Geometry::box(const Vector3f& boundsMin, const Vector3f& boundsMax) {
+    Matrix3Xf vertices(3, 8);
+    for (int corner = 0; corner < 8; corner++) {
+        vertices.col(corner) << (corner & 1 ? boundsMax : boundsMin)(0),
+                                (corner & 2 ? boundsMax : boundsMin)(1),
+                                (corner & 4 ? boundsMax : boundsMin)(2);
+    }
+    Matrix3Xu faces(3, 12);
+    faces << 0, 0, 4, 4, 0, 0, 2, 2, 0, 0, 1, 1,
+             2, 3, 5, 7, 1, 5, 7, 6, 4, 6, 3, 7,
+             3, 1, 7, 6, 5, 4, 3, 7, 6, 2, 7, 5;
+    return make_shared<Geometry>(vertices, faces);
+}
+
+Vector3f Geometry::calculateBarycenter(const Matrix3Xu &faces, const Matrix3Xf &vertices) {
+    Vector3f centroid(0., 0., 0.);
+    for (long faceNumber = 0; faceNumber < faces.cols(); faceNumber++) {
+        const Vector3f a = vertices.col(faces(0, faceNumber));
+        const Vector3f b = vertices.col(faces(1, faceNumber));
+        const Vector3f c = vertices.col(faces(2, faceNumber));
+
+        const Vector3f center = (a + b + c) / 3;
+        centroid = centroid + center;
+    }
+    return centroid / faces.cols();
+}
+
+Matrix3Xf Geometry::calculateVertexNormals(const Matrix3Xu& faces, const Matrix3Xf& vertices,
+        const Adjacency& adjacency, NormalWeighting weighting, ThreadPool* pool) {
+    const long numFaces = faces.cols();
+    const long numVertices = vertices.cols();
+
+    // Face normals, plus the interior angle of every corner when weighting by angle
+    Matrix3Xf faceNormals(3, numFaces);
+    Matrix3Xf cornerAngles(3, weighting == ANGLE_WEIGHTING ? numFaces : 0);
+    ThreadPool::parallelFor(pool, numFaces, 4096, [&](long first, long last) {
+        for (long faceNumber = first; faceNumber < last; faceNumber++) {
+            Vector3f a = vertices.col(faces(0, faceNumber));
+            Vector3f b = vertices.col(faces(1, faceNumber));
+            Vector3f c = vertices.col(faces(2, faceNumber));
+            Vector3f normal = (b - a).cross(c - a);
+
+            if (weighting == AREA_WEIGHTING) {
+                // The length of the cross product is twice the area of the face
+                faceNormals.col(faceNumber) = 0.5f * normal;
+                continue;
+            }
+            faceNormals.col(faceNumber) = normal.normalized();
+            if (weighting == ANGLE_WEIGHTING) {
+                const Vector3f* corners[3] = {&a, &b, &c};
+                for (int k = 0; k < 3; k++) {
+                    Vector3f toNext = (*corners[(k + 1) % 3] - *corners[k]).normalized();
+                    Vector3f toPrevious = (*corners[(k + 2) % 3] - *corners[k]).normalized();
+                    cornerAngles(k, faceNumber) = acos(max(-1.0f, min(1.0f, toNext.dot(toPrevious))));
+                }
+            }
+        }
+    });
+
+    Matrix3Xf normals(3, numVertices);
+    ThreadPool::parallelFor(pool, numVertices, 4096, [&](long first, long last) {
+        for (long vertexNumber = first; vertexNumber < last; vertexNumber++) {
+            Vector3f vertexNormal(0.0, 0.0, 0.0);
+            for (const uint32_t* i = adjacency.beginVertexCorners(vertexNumber); i != adjacency.endVertexCorners(vertexNumber); i++) {
+                uint32_t corner = *i;
+                if (weighting == ANGLE_WEIGHTING) {
+                    vertexNormal += cornerAngles.data()[corner] * faceNormals.col(corner / 3);
+                } else {
+                    vertexNormal += faceNormals.col(corner / 3);
+                }
+            }
+            normals.col(vertexNumber) = vertexNormal.normalized();
+        }
+    });
+    return normals;
+}
+
+void Geometry::calculateBounds(const Matrix3Xf& vertices, Vector3f& boundsMin, Vector3f& boundsMax) {
+    if (vertices.cols() == 0) {
+        boundsMin = boundsMax = Vector3f::Zero();
+        return;
+    }
+    boundsMin = vertices.rowwise().minCoeff();
+    boundsMax = vertices.rowwise().maxCoeff();
+}
+
+uint64_t Geometry::calculateContentHash(const Matrix3Xf& vertices, const Matrix3Xu& faces) {
+    uint64_t hashes[2] = {
+            Utils::hashBytes(vertices.data(), sizeof(float) * vertices.size()),
+            Utils::hashBytes(faces.data(), sizeof(uint32_t) * faces.size())
+    };
+    return Utils::hashBytes(hashes, sizeof(hashes));
+}
+
+const Matrix3Xf& Geometry::getVertices() const {
+    return vertices;
+}
+
+const Matrix3Xu& Geometry::getFaces() const {
+    return faces;
+}
+
+const Matrix3Xf& Geometry::getVertexNormals() const {
+    return vertexNormals;
+}
+
+Matrix6Xf Geometry::getInterleavedVertices() const {
+    Matrix6Xf records(6, vertices.cols());
+    records.topRows<3>() = vertices;
+    records.bottomRows<3>() = vertexNormals;
+    return records;
+}
+
+Vector3f Geometry::getFaceNormal(long faceNumber) const {
+    Vector3f a = vertices.col(faces(0, faceNumber));
+    Vector3f b = vertices.col(faces(1, faceNumber));
+    Vector3f c = vertices.col(faces(2, faceNumber));
+    return ((b - a).cross(c - a)).normalized();
+}
+
+const Adjacency& Geometry::getAdjacency() const {
+    call_once(adjacencyBuilt, [this]() {
+        ThreadPool* pool = faces.cols() >= PARALLEL_FACES ? &ThreadPool::shared() : nullptr;
+        adjacency.reset(new Adjacency(faces, vertices.cols(), pool));
+    });
+    return *adjacency;
+}
+
+const Bvh& Geometry::getBvh() const {
+    call_once(bvhBuilt, [this]() {
+        bvh.reset(new Bvh(faces, vertices));
+        triangleBlocks.reset(new TriangleBlocks(*bvh, faces, vertices));
+    });
+    return *bvh;
+}
+
+const TriangleBlocks& Geometry::getTriangleBlocks() const {
+    getBvh();
+    return *triangleBlocks;
+}
+
+bool Geometry::intersect(const Vector3f& origin, const Vector3f& direction, RayHit& hit) const {
+    return getTriangleBlocks().intersect(origin, direction, hit);
+}
+
+const Vector3f& Geometry::getBoundsMin() const {
+    return boundsMin;
+}
+
+const Vector3f& Geometry::getBoundsMax() const {
+    return boundsMax;
+}
+
+uint64_t Geometry::getContentHash() const {
+    return contentHash;
+}
+
+const string& Geometry::getSourcePath() const {
+    return sourcePath;
+}
+
+shared_ptr<const RowVectorXf> Geometry::getAmbientOcclusion() const {
+    return atomic_load(&ambientOcclusion);
+}
+
+void Geometry::setAmbientOcclusion(const shared_ptr<const RowVectorXf>& ambientOcclusion) const {
+    atomic_store(&this->ambientOcclusion, ambientOcclusion);
+}
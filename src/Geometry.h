@@ -0,0 +1,112 @@
+//
+// Immutable indexed triangle geometry shared by every Mesh instance of the same asset.
+//
+
+#ifndef UNTITLED_GEOMETRY_H
+#define UNTITLED_GEOMETRY_H
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "Adjacency.h"
+#include "Bvh.h"
+#include "OffParser.h"
+#include "TriangleBlocks.h"
+#include "Utils.h"
+
+using namespace Eigen;
+
+// How the normals of the faces around a vertex are weighted into the vertex normal
+enum NormalWeighting {
+    UNIFORM_WEIGHTING,
+    AREA_WEIGHTING,
+    ANGLE_WEIGHTING
+};
+
+class Geometry {
+private:
+    Matrix3Xf vertices;
+    Matrix3Xu faces;
+    Matrix3Xf vertexNormals;
+    Vector3f boundsMin;
+    Vector3f boundsMax;
+    uint64_t contentHash;
+    std::string sourcePath;
+    // Baked after loading, so it is swapped in atomically while renderers may be reading it
+    mutable std::shared_ptr<const RowVectorXf> ambientOcclusion;
+
+    mutable std::once_flag adjacencyBuilt;
+    mutable std::unique_ptr<const Adjacency> adjacency;
+    mutable std::once_flag bvhBuilt;
+    mutable std::unique_ptr<const Bvh> bvh;
+    // Built with the hierarchy and destroyed before it
+    mutable std::unique_ptr<const TriangleBlocks> triangleBlocks;
+
+    static Vector3f calculateBarycenter(const Matrix3Xu& faces, const Matrix3Xf& vertices);
+    static void calculateBounds(const Matrix3Xf& vertices, Vector3f& boundsMin, Vector3f& boundsMax);
+    static uint64_t calculateContentHash(const Matrix3Xf& vertices, const Matrix3Xu& faces);
+
+    // Used by MeshCache to restore geometry whose derived data has already been computed
+    Geometry(const Matrix3Xf& vertices, const Matrix3Xu& faces, const Matrix3Xf& vertexNormals,
+            const Vector3f& boundsMin, const Vector3f& boundsMax);
+
+    friend class MeshCache;
+
+public:
+    // Meshes with at least this many faces build their adjacency and normals on ThreadPool::shared()
+    static const long PARALLEL_FACES = 1 << 16;
+
+    Geometry(const Matrix3Xf& vertices, const Matrix3Xu& faces);
+
+    // Normalized sum of the weighted normals of the faces around every vertex, zero for unused vertices.
+    // Runs in O(F): face normals are computed once and every vertex then sums the faces of its
+    // corners in the adjacency of faces, in parallel with a pool. Corners are summed in face order,
+    // so the result does not depend on the pool.
+    static Matrix3Xf calculateVertexNormals(const Matrix3Xu& faces, const Matrix3Xf& vertices,
+            const Adjacency& adjacency, NormalWeighting weighting = UNIFORM_WEIGHTING, ThreadPool* pool = nullptr);
+
+    // Loads the file through its binary cache and centres it on its barycenter.
+    // Returns null if onProgress cancelled the load, throws std::runtime_error on bad files.
+    static std::shared_ptr<const Geometry> fromOffFile(const std::string& filePath,
+            const OffParser::ProgressCallback& onProgress = OffParser::ProgressCallback());
+
+    // Axis aligned box
+    static std::shared_ptr<const Geometry> box(const Vector3f& boundsMin, const Vector3f& boundsMax);
+
+    const Matrix3Xf& getVertices() const;
+    // Column major, so faces.data() doubles as the flat index buffer with three indices per triangle
+    const Matrix3Xu& getFaces() const;
+    // One normal per vertex, shared by all triangles that use the vertex. Flat shading
+    // derives the face normal in the fragment shader instead of storing it.
+    const Matrix3Xf& getVertexNormals() const;
+    // Positions and normals interleaved into one record per vertex, the layout of the vertex
+    // buffer of GpuGeometryCache
+    Matrix6Xf getInterleavedVertices() const;
+    Vector3f getFaceNormal(long faceNumber) const;
+    // Built on first use and then kept for the lifetime of the geometry, safe to call from any thread.
+    // Geometry built from faces has it already, for its normals.
+    const Adjacency& getAdjacency() const;
+    // Built on first use like the adjacency
+    const Bvh& getBvh() const;
+    // Faces of the leaves of getBvh in SIMD blocks, built along with it
+    const TriangleBlocks& getTriangleBlocks() const;
+    // Closest hit of the ray origin + t * direction in the space of the vertices, see TriangleBlocks::intersect
+    bool intersect(const Vector3f& origin, const Vector3f& direction, RayHit& hit) const;
+    const Vector3f& getBoundsMin() const;
+    const Vector3f& getBoundsMax() const;
+    // Hash of the vertices and faces, equal for geometry loaded from identical files
+    uint64_t getContentHash() const;
+    // File the geometry was loaded from, empty for geometry built in memory
+    const std::string& getSourcePath() const;
+
+    // Fraction of the hemisphere above every vertex that is open, see AmbientOcclusionBake.
+    // Null until it has been baked or restored from the cache.
+    std::shared_ptr<const RowVectorXf> getAmbientOcclusion() const;
+    // Shared by every mesh of the geometry, safe to call while other threads read it
+    void setAmbientOcclusion(const std::shared_ptr<const RowVectorXf>& ambientOcclusion) const;
+};
+
+
+#endif //UNTITLED_GEOMETRY_H
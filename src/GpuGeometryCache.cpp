@@ -0,0 +1,157 @@
+//
+// GL buffers of the geometries being drawn, uploaded once and shared by all of their meshes.
+//
+
+#include "GpuGeometryCache.h"
+
+#include <cstddef>
+
+using namespace std;
+
+GpuGeometryCache::GpuGeometryCache(const Program& program) : program(program) {
+}
+
+void GpuGeometryCache::beginFrame() {
+    frameUploadBytes = 0;
+    // Geometry without a bake reads the current value of the disabled attribute, which is context
+    // state rather than part of any vertex array
+    glVertexAttrib1f(program.attrib("vertex_occlusion"), 1.0f);
+    for (auto entry = buffers.begin(); entry != buffers.end();) {
+        if (entry->second->geometry.expired()) {
+            free(*entry->second);
+            entry = buffers.erase(entry);
+        } else {
+            ++entry;
+        }
+    }
+}
+
+const GpuGeometryCache::Buffers& GpuGeometryCache::bind(const shared_ptr<const Geometry>& geometry) {
+    Buffers& entry = bindBuffers(geometry);
+    if (entry.streamedPositions) {
+        program.bindVertexAttribArray("position", entry.vertices, 3, 0);
+        entry.streamedPositions = false;
+    }
+    return entry;
+}
+
+const GpuGeometryCache::Buffers& GpuGeometryCache::bind(const shared_ptr<const Geometry>& geometry,
+                                                        const StreamBuffer& stream, GLintptr offset) {
+    Buffers& entry = bindBuffers(geometry);
+    stream.bindVertexAttribArray(program.attrib("position"), 3, offset);
+    entry.streamedPositions = true;
+    return entry;
+}
+
+void GpuGeometryCache::bindInstances(const StreamBuffer& stream, GLintptr offset) const {
+    typedef InstanceBatches::InstanceAttributes InstanceAttributes;
+    const GLsizei stride = sizeof(InstanceAttributes);
+    GLint model = program.attrib("instance_model");
+    for (GLint column = 0; model >= 0 && column < 4; column++) {
+        stream.bindVertexAttribArray(model + column, 4, offset + offsetof(InstanceAttributes, model) + 16 * column, stride);
+    }
+    GLint normalModel = program.attrib("instance_normal_model");
+    for (GLint column = 0; normalModel >= 0 && column < 3; column++) {
+        stream.bindVertexAttribArray(normalModel + column, 3,
+                                     offset + offsetof(InstanceAttributes, normalModel) + 12 * column, stride);
+    }
+    stream.bindVertexAttribArray(program.attrib("instance_color"), 4, offset + offsetof(InstanceAttributes, color), stride);
+}
+
+GpuGeometryCache::Buffers& GpuGeometryCache::bindBuffers(const shared_ptr<const Geometry>& geometry) {
+    unique_ptr<Buffers>& entry = buffers[geometry.get()];
+    // A new geometry may have been allocated where a released one was
+    if (entry && entry->geometry.lock() != geometry) {
+        free(*entry);
+        entry.reset();
+    }
+    if (!entry) {
+        entry.reset(new Buffers());
+        entry->geometry = geometry;
+        upload(*entry, *geometry);
+    }
+    entry->vertexArray.bind();
+
+    shared_ptr<const RowVectorXf> occlusion = geometry->getAmbientOcclusion();
+    if (occlusion != entry->uploadedOcclusion) {
+        uploadOcclusion(*entry, occlusion);
+    }
+    return *entry;
+}
+
+void GpuGeometryCache::upload(Buffers& buffers, const Geometry& geometry) {
+    buffers.vertexArray.init();
+    buffers.vertexArray.bind();
+
+    // Deforming meshes read their positions from a stream buffer instead, and only the normals from here
+    buffers.vertices.init();
+    buffers.vertices.update(geometry.getInterleavedVertices());
+    program.bindVertexAttribArray("position", buffers.vertices, 3, 0);
+    program.bindVertexAttribArray("vertex_normal", buffers.vertices, 3, 3);
+
+    // The element buffer binding is stored in the vertex array
+    buffers.elements.init();
+    buffers.elements.bind();
+    buffers.elements.update(geometry.getFaces(), geometry.getVertices().cols());
+
+    // Per instance inputs advance once per instance, matrices take a location per column
+    const char* instanceInputs[] = {"instance_model", "instance_normal_model", "instance_color"};
+    const int instanceColumns[] = {4, 3, 1};
+    for (int input = 0; input < 3; input++) {
+        GLint attribute = program.attrib(instanceInputs[input]);
+        for (int column = 0; attribute >= 0 && column < instanceColumns[input]; column++) {
+            glEnableVertexAttribArray(attribute + column);
+            glVertexAttribDivisor(attribute + column, 1);
+        }
+    }
+
+    long bytes = sizeof(float) * 6 * geometry.getVertices().cols()
+            + (buffers.elements.type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t)) * buffers.elements.count;
+    frameUploadBytes += bytes;
+    totalUploadBytes += bytes;
+}
+
+void GpuGeometryCache::uploadOcclusion(Buffers& buffers, const shared_ptr<const RowVectorXf>& occlusion) {
+    GLint attribute = program.attrib("vertex_occlusion");
+    if (!occlusion) {
+        glDisableVertexAttribArray(attribute);
+        buffers.uploadedOcclusion = nullptr;
+        return;
+    }
+    if (buffers.occlusion.id == 0) {
+        buffers.occlusion.init();
+    }
+    buffers.occlusion.update(*occlusion);
+    program.bindVertexAttribArray("vertex_occlusion", buffers.occlusion);
+    buffers.uploadedOcclusion = occlusion;
+    frameUploadBytes += sizeof(float) * occlusion->size();
+    totalUploadBytes += sizeof(float) * occlusion->size();
+}
+
+void GpuGeometryCache::free(Buffers& buffers) {
+    buffers.vertexArray.free();
+    buffers.vertices.free();
+    if (buffers.occlusion.id != 0) {
+        buffers.occlusion.free();
+    }
+    buffers.elements.free();
+}
+
+void GpuGeometryCache::clear() {
+    for (auto& entry : buffers) {
+        free(*entry.second);
+    }
+    buffers.clear();
+}
+
+long GpuGeometryCache::getFrameUploadBytes() const {
+    return frameUploadBytes;
+}
+
+long GpuGeometryCache::getTotalUploadBytes() const {
+    return totalUploadBytes;
+}
+
+size_t GpuGeometryCache::size() const {
+    return buffers.size();
+}
@@ -0,0 +1,77 @@
+//
+// GL buffers of the geometries being drawn, uploaded once and shared by all of their meshes.
+//
+
+#ifndef UNTITLED_GPUGEOMETRYCACHE_H
+#define UNTITLED_GPUGEOMETRYCACHE_H
+
+#include "Geometry.h"
+#include "Helpers.h"
+#include "InstanceBatches.h"
+#include "StreamBuffer.h"
+
+#include <memory>
+#include <unordered_map>
+
+// Every geometry gets a vertex array object with its interleaved positions and normals, ambient
+// occlusion and indices on the first draw. Geometry never changes after loading, so drawing again
+// only binds the vertex array. The ambient occlusion is uploaded again when a bake replaces it.
+// Meshes that deform can read their positions from a StreamBuffer instead. The per instance inputs
+// advance once per instance and come from wherever bindInstances points them. Buffers of geometry
+// whose last mesh is gone are freed by the next beginFrame.
+class GpuGeometryCache {
+public:
+    struct Buffers {
+        // Only used to tell when the geometry is gone, the buffers never keep it alive
+        std::weak_ptr<const Geometry> geometry;
+        VertexArrayObject vertexArray;
+        // Geometry::getInterleavedVertices, so a vertex reads one 24 byte record
+        VertexBufferObject vertices;
+        VertexBufferObject occlusion;
+        ElementBufferObject elements;
+        std::shared_ptr<const RowVectorXf> uploadedOcclusion;
+        // The position input points into a stream buffer since the last draw
+        bool streamedPositions = false;
+    };
+
+private:
+    const Program& program;
+    std::unordered_map<const Geometry*, std::unique_ptr<Buffers>> buffers;
+    long frameUploadBytes = 0;
+    long totalUploadBytes = 0;
+
+    Buffers& bindBuffers(const std::shared_ptr<const Geometry>& geometry);
+    void upload(Buffers& buffers, const Geometry& geometry);
+    void uploadOcclusion(Buffers& buffers, const std::shared_ptr<const RowVectorXf>& occlusion);
+    static void free(Buffers& buffers);
+
+public:
+    // The attributes are bound to the inputs of program with the same names as in the shader
+    explicit GpuGeometryCache(const Program& program);
+
+    GpuGeometryCache(const GpuGeometryCache&) = delete;
+    GpuGeometryCache& operator=(const GpuGeometryCache&) = delete;
+
+    // Resets the frame counter and frees the buffers of geometry that has been released, call
+    // with program bound
+    void beginFrame();
+
+    // Binds the vertex array of the geometry, uploading whatever is missing or outdated first
+    const Buffers& bind(const std::shared_ptr<const Geometry>& geometry);
+    // Same as above with the positions read from offset in stream, for one draw
+    const Buffers& bind(const std::shared_ptr<const Geometry>& geometry, const StreamBuffer& stream, GLintptr offset);
+    // Points the per instance inputs of the bound vertex array to InstanceBatches attributes at
+    // offset in stream
+    void bindInstances(const StreamBuffer& stream, GLintptr offset) const;
+
+    // Frees all buffers, has to run while the GL context is still current
+    void clear();
+
+    // Bytes passed to the driver since beginFrame, and since the cache was created
+    long getFrameUploadBytes() const;
+    long getTotalUploadBytes() const;
+    size_t size() const;
+};
+
+
+#endif //UNTITLED_GPUGEOMETRYCACHE_H
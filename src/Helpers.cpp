@@ -1,5 +1,6 @@
 #include "Helpers.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
@@ -12,9 +13,9 @@ GLFWwindow* HelperGL::initAndCreateGLFWWindow() {
     // Activate supersampling
     glfwWindowHint(GLFW_SAMPLES, 8);
 
-    // Ensure that we get at least a 3.2 context
+    // Ensure that we get at least a 3.3 context, which has instanced vertex attributes
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 
     // On apple we have to load a core profile with forward compatibility
 #ifdef __APPLE__
@@ -92,7 +93,7 @@ void VertexBufferObject::free()
   check_gl_error();
 }
 
-void VertexBufferObject::update(const Eigen::MatrixXf& M)
+void VertexBufferObject::update(const Eigen::Ref<const Eigen::MatrixXf>& M)
 {
   assert(id != 0);
   glBindBuffer(GL_ARRAY_BUFFER, id);
@@ -102,14 +103,60 @@ void VertexBufferObject::update(const Eigen::MatrixXf& M)
   check_gl_error();
 }
 
+ElementBufferObject::ElementBufferObject() : id(0), count(0), type(GL_UNSIGNED_INT) {}
+
+void ElementBufferObject::init()
+{
+  glGenBuffers(1,&id);
+  check_gl_error();
+}
+
+void ElementBufferObject::bind()
+{
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,id);
+  check_gl_error();
+}
+
+void ElementBufferObject::free()
+{
+  glDeleteBuffers(1,&id);
+  check_gl_error();
+}
+
+void ElementBufferObject::update(const Eigen::Matrix<uint32_t, 3, Eigen::Dynamic>& faces, long numVertices)
+{
+  assert(id != 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
+  if (numVertices <= 65536)
+  {
+    shortIndices.assign(faces.data(), faces.data() + faces.size());
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t)*shortIndices.size(), shortIndices.data(), GL_DYNAMIC_DRAW);
+    type = GL_UNSIGNED_SHORT;
+  }
+  else
+  {
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t)*faces.size(), faces.data(), GL_DYNAMIC_DRAW);
+    type = GL_UNSIGNED_INT;
+  }
+  count = faces.size();
+  check_gl_error();
+}
+
 bool Program::init(
   const std::string &vertex_shader_string,
   const std::string &fragment_shader_string,
-  const std::string &fragment_data_name)
+  const std::string &fragment_data_name,
+  const std::string &geometry_shader_string)
 {
   using namespace std;
   vertex_shader = create_shader_helper(GL_VERTEX_SHADER, vertex_shader_string);
   fragment_shader = create_shader_helper(GL_FRAGMENT_SHADER, fragment_shader_string);
+  if (!geometry_shader_string.empty())
+  {
+    geometry_shader = create_shader_helper(GL_GEOMETRY_SHADER, geometry_shader_string);
+    if (!geometry_shader)
+      return false;
+  }
 
   if (!vertex_shader || !fragment_shader)
     return false;
@@ -118,8 +165,23 @@ bool Program::init(
 
   glAttachShader(program_shader, vertex_shader);
   glAttachShader(program_shader, fragment_shader);
+  if (geometry_shader)
+    glAttachShader(program_shader, geometry_shader);
 
   glBindFragDataLocation(program_shader, 0, fragment_data_name.c_str());
+  return link();
+}
+
+bool Program::shareAttribLocations(const Program &other)
+{
+  for (const auto &attrib : other.attribs)
+    glBindAttribLocation(program_shader, attrib.second, attrib.first.c_str());
+  return link();
+}
+
+bool Program::link()
+{
+  using namespace std;
   glLinkProgram(program_shader);
 
   GLint status;
@@ -134,10 +196,46 @@ bool Program::init(
     return false;
   }
 
+  cache_locations();
   check_gl_error();
   return true;
 }
 
+void Program::cache_locations()
+{
+  attribs.clear();
+  uniforms.clear();
+  GLint count, maxLength;
+  GLint size;
+  GLenum type;
+
+  glGetProgramiv(program_shader, GL_ACTIVE_ATTRIBUTES, &count);
+  glGetProgramiv(program_shader, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+  std::vector<char> name(std::max(maxLength, 1));
+  for (GLint i = 0; i < count; i++)
+  {
+    glGetActiveAttrib(program_shader, i, name.size(), NULL, &size, &type, name.data());
+    attribs[name.data()] = glGetAttribLocation(program_shader, name.data());
+  }
+
+  glGetProgramiv(program_shader, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(program_shader, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+  name.resize(std::max(maxLength, 1));
+  for (GLint i = 0; i < count; i++)
+  {
+    glGetActiveUniform(program_shader, i, name.size(), NULL, &size, &type, name.data());
+    // Members of uniform blocks have no location
+    GLint location = glGetUniformLocation(program_shader, name.data());
+    if (location < 0)
+      continue;
+    std::string uniformName = name.data();
+    uniforms[uniformName] = location;
+    // Arrays are listed as their first element, but can be set by their plain name too
+    if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+      uniforms[uniformName.substr(0, uniformName.size() - 3)] = location;
+  }
+}
+
 void Program::bind()
 {
   glUseProgram(program_shader);
@@ -146,12 +244,24 @@ void Program::bind()
 
 GLint Program::attrib(const std::string &name) const
 {
-  return glGetAttribLocation(program_shader, name.c_str());
+  auto found = attribs.find(name);
+  return found == attribs.end() ? -1 : found->second;
 }
 
 GLint Program::uniform(const std::string &name) const
 {
-  return glGetUniformLocation(program_shader, name.c_str());
+  auto found = uniforms.find(name);
+  return found == uniforms.end() ? -1 : found->second;
+}
+
+bool Program::bindUniformBlock(const std::string &name, GLuint binding) const
+{
+  GLuint index = glGetUniformBlockIndex(program_shader, name.c_str());
+  if (index == GL_INVALID_INDEX)
+    return false;
+  glUniformBlockBinding(program_shader, index, binding);
+  check_gl_error();
+  return true;
 }
 
 GLint Program::bindVertexAttribArray(
@@ -173,6 +283,21 @@ GLint Program::bindVertexAttribArray(
   return id;
 }
 
+GLint Program::bindVertexAttribArray(
+        const std::string &name, VertexBufferObject& VBO, GLint size, GLint firstRow) const
+{
+  GLint id = attrib(name);
+  if (id < 0)
+    return id;
+  VBO.bind();
+  glEnableVertexAttribArray(id);
+  glVertexAttribPointer(id, size, GL_FLOAT, GL_FALSE, VBO.rows * sizeof(float),
+                        (const void*) (firstRow * sizeof(float)));
+  check_gl_error();
+
+  return id;
+}
+
 void Program::free()
 {
   if (program_shader)
@@ -190,6 +315,13 @@ void Program::free()
     glDeleteShader(fragment_shader);
     fragment_shader = 0;
   }
+  if (geometry_shader)
+  {
+    glDeleteShader(geometry_shader);
+    geometry_shader = 0;
+  }
+  attribs.clear();
+  uniforms.clear();
   check_gl_error();
 }
 
@@ -1,7 +1,9 @@
 #ifndef SHADER_H
 #define SHADER_H
 
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <Eigen/Core>
 #include <GLFW/glfw3.h>
@@ -68,8 +70,8 @@ public:
     // Create a new empty VBO
     void init();
 
-    // Updates the VBO with a matrix M
-    void update(const Eigen::MatrixXf& M);
+    // Updates the VBO with a matrix M, fixed size matrices such as Matrix3Xf are passed without a copy
+    void update(const Eigen::Ref<const Eigen::MatrixXf>& M);
 
     // Select this VBO for subsequent draw calls
     void bind();
@@ -78,7 +80,37 @@ public:
     void free();
 };
 
-// This class wraps an OpenGL boundProgram composed of two shaders
+class ElementBufferObject
+{
+public:
+    typedef unsigned int GLuint;
+    typedef unsigned int GLenum;
+
+    GLuint id;
+    GLuint count;
+    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, whichever the last update needed
+    GLenum type;
+
+    ElementBufferObject();
+
+    // Create a new empty EBO
+    void init();
+
+    // Updates the EBO with triangle indices into numVertices vertices, one column per triangle.
+    // 16 bit indices are uploaded when every index fits in them.
+    void update(const Eigen::Matrix<uint32_t, 3, Eigen::Dynamic>& faces, long numVertices);
+
+    // Attach this EBO to the bound VAO
+    void bind();
+
+    // Release the id
+    void free();
+
+private:
+    std::vector<uint16_t> shortIndices;
+};
+
+// This class wraps an OpenGL boundProgram composed of two shaders, and optionally a geometry shader
 class Program
 {
 public:
@@ -87,14 +119,20 @@ public:
 
   GLuint vertex_shader;
   GLuint fragment_shader;
+  GLuint geometry_shader;
   GLuint program_shader;
 
-  Program() : vertex_shader(0), fragment_shader(0), program_shader(0) { }
+  Program() : vertex_shader(0), fragment_shader(0), geometry_shader(0), program_shader(0) { }
 
-  // Create a new shader from the specified source strings
+  // Create a new shader from the specified source strings, without a geometry shader if its string is empty
   bool init(const std::string &vertex_shader_string,
   const std::string &fragment_shader_string,
-  const std::string &fragment_data_name);
+  const std::string &fragment_data_name,
+  const std::string &geometry_shader_string = "");
+
+  // Give the attributes of other the same locations here and link again, so that vertex arrays
+  // set up for other draw with this program too (false if linking fails)
+  bool shareAttribLocations(const Program &other);
 
   // Select this shader for subsequent draw calls
   void bind();
@@ -108,11 +146,24 @@ public:
   // Return the OpenGL handle of a uniform attribute (-1 if it does not exist)
   GLint uniform(const std::string &name) const;
 
+  // Connect a named uniform block to a binding point of glBindBufferRange (false if it does not exist)
+  bool bindUniformBlock(const std::string &name, GLuint binding) const;
+
   // Bind a per-vertex array attribute
   GLint bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO) const;
 
+  // Bind size rows of every column of a VBO with interleaved records, starting at firstRow
+  GLint bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO, GLint size, GLint firstRow) const;
+
   GLuint create_shader_helper(GLint type, const std::string &shader_string);
 
+private:
+  // Locations of the active attributes and uniforms, looked up once after linking
+  std::unordered_map<std::string, GLint> attribs;
+  std::unordered_map<std::string, GLint> uniforms;
+
+  bool link();
+  void cache_locations();
 };
 
 // From: https://blog.nobel-joergensen.com/2013/01/29/debugging-opengl-using-glgeterror/
@@ -0,0 +1,146 @@
+//
+// Picks the mesh under the cursor while it moves, for hover highlighting.
+//
+
+#include "HoverPicker.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace std;
+
+// A frame at 60 Hz lasts 16 ms, a query may take a small part of that
+const double HoverPicker::BUDGET_MILLISECONDS = 1.0;
+
+namespace {
+
+double millisecondsSince(HoverPicker::Clock::time_point start) {
+    return chrono::duration<double, milli>(HoverPicker::Clock::now() - start).count();
+}
+
+}
+
+HoverPicker::~HoverPicker() {
+    if (running.valid()) {
+        running.wait();
+    }
+}
+
+void HoverPicker::setEnabled(bool enabled) {
+    this->enabled = enabled;
+    if (!enabled) {
+        hoveredMeshId = -1;
+    }
+}
+
+bool HoverPicker::isEnabled() const {
+    return enabled;
+}
+
+void HoverPicker::moveCursor(double x, double y) {
+    numCursorEvents++;
+    cursorMoved = true;
+    cursorEventTime = Clock::now();
+    cursorX = x;
+    cursorY = y;
+}
+
+bool HoverPicker::update(World& world, double& x, double& y) {
+    if (running.valid()) {
+        if (running.wait_for(chrono::seconds(0)) != future_status::ready) {
+            return false;
+        }
+        running.get();
+        // The copy keeps the ids of the meshes, which still find them after others were removed
+        finish(snapshot->getMeshId(runningResult->meshIndex), runningResult->milliseconds, runningSince);
+        world.takePickingHierarchy(*snapshot);
+    }
+    if (!enabled || !cursorMoved) {
+        return false;
+    }
+    x = cursorX;
+    y = cursorY;
+    return true;
+}
+
+void HoverPicker::pick(World& world, const Vector3f& origin, const Vector3f& direction) {
+    Clock::time_point since = cursorEventTime;
+    cursorMoved = false;
+    numQueries++;
+
+    if (lastQueryMilliseconds <= BUDGET_MILLISECONDS && world.hasPickingHierarchy()) {
+        Clock::time_point start = Clock::now();
+        RayHit hit;
+        int meshIndex = world.pick(origin, direction, hit, world.getMeshIndex(hoveredMeshId));
+        finish(world.getMeshId(meshIndex), millisecondsSince(start), since);
+        return;
+    }
+
+    // The copy is only made again when the world has changed, so it keeps its picking hierarchy
+    if (!snapshot || snapshot->getVersion() != world.getVersion()) {
+        snapshot = make_shared<World>(world);
+    }
+    if (!worker) {
+        worker.reset(new ThreadPool(1));
+    }
+    shared_ptr<World> scene = snapshot;
+    shared_ptr<Result> result = make_shared<Result>();
+    int hintMeshIndex = scene->getMeshIndex(hoveredMeshId);
+    runningResult = result;
+    runningSince = since;
+    running = worker->submit([scene, result, origin, direction, hintMeshIndex]() {
+        Clock::time_point start = Clock::now();
+        RayHit hit;
+        result->meshIndex = scene->pick(origin, direction, hit, hintMeshIndex);
+        result->milliseconds = millisecondsSince(start);
+    });
+}
+
+void HoverPicker::finish(int meshId, double milliseconds, Clock::time_point since) {
+    lastQueryMilliseconds = milliseconds;
+    if (enabled) {
+        hoveredMeshId = meshId;
+    }
+    double latency = millisecondsSince(since);
+    // The whole ring at once, so that only the first query allocates
+    if (latencies.empty()) {
+        latencies.reserve(MAX_LATENCIES);
+    }
+    if (latencies.size() < MAX_LATENCIES) {
+        latencies.push_back(latency);
+    } else {
+        latencies[nextLatency] = latency;
+        nextLatency = (nextLatency + 1) % MAX_LATENCIES;
+    }
+}
+
+int HoverPicker::getHoveredMeshId() const {
+    return hoveredMeshId;
+}
+
+long HoverPicker::getNumCursorEvents() const {
+    return numCursorEvents;
+}
+
+long HoverPicker::getNumQueries() const {
+    return numQueries;
+}
+
+double HoverPicker::getLatencyPercentile(double percentile) const {
+    if (latencies.empty()) {
+        return 0;
+    }
+    vector<double> sorted(latencies);
+    size_t rank = min(sorted.size() - 1, (size_t) (percentile / 100 * sorted.size()));
+    nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
+
+void HoverPicker::printStatistics() const {
+    if (numQueries == 0) {
+        return;
+    }
+    cout << "Hover picking: " << numCursorEvents << " cursor events in " << numQueries << " queries, latency p50 "
+         << getLatencyPercentile(50) << " ms, p90 " << getLatencyPercentile(90) << " ms, p99 "
+         << getLatencyPercentile(99) << " ms, max " << getLatencyPercentile(100) << " ms" << endl;
+}
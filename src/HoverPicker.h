@@ -0,0 +1,87 @@
+//
+// Picks the mesh under the cursor while it moves, for hover highlighting.
+//
+
+#ifndef UNTITLED_HOVERPICKER_H
+#define UNTITLED_HOVERPICKER_H
+
+#include "World.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <vector>
+
+// Mice report the cursor up to 1000 times a second, far more often than frames are drawn. Only
+// the latest position is queried, at most once per frame. Queries that took longer than the
+// budget, or would first rebuild the picking hierarchy of the world, move to a worker thread
+// that picks a copy of the world. The frame goes on with the previous result until it is done.
+class HoverPicker {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const double BUDGET_MILLISECONDS;
+    // Latencies of the last this many queries are kept for the percentiles
+    static const size_t MAX_LATENCIES = 4096;
+
+private:
+    struct Result {
+        int meshIndex = -1;
+        double milliseconds = 0;
+    };
+
+    bool enabled = false;
+    bool cursorMoved = false;
+    double cursorX = 0;
+    double cursorY = 0;
+    // Latency is measured from the event whose position a query answers
+    Clock::time_point cursorEventTime;
+    long numCursorEvents = 0;
+    long numQueries = 0;
+    int hoveredMeshId = -1;
+    double lastQueryMilliseconds = 0;
+
+    std::unique_ptr<ThreadPool> worker;
+    // Only read by the worker while a query is running, and only replaced between queries
+    std::shared_ptr<World> snapshot;
+    std::future<void> running;
+    std::shared_ptr<Result> runningResult;
+    Clock::time_point runningSince;
+
+    std::vector<double> latencies;
+    size_t nextLatency = 0;
+
+    void finish(int meshId, double milliseconds, Clock::time_point since);
+
+public:
+    ~HoverPicker();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    // Called from the cursor position callback
+    void moveCursor(double x, double y);
+
+    // Call once per frame. Takes the result of a finished background query and returns true with
+    // the latest cursor position when it has moved since the last query and no query is running.
+    // A hierarchy the worker built for an unchanged world is handed to world.
+    bool update(World& world, double& x, double& y);
+
+    // Picks the ray through the cursor position returned by update. The mesh hovered before is
+    // tested first, which bounds the search while the cursor stays on it.
+    void pick(World& world, const Vector3f& origin, const Vector3f& direction);
+
+    // Id of the mesh under the cursor, -1 if there is none or hover picking is off
+    int getHoveredMeshId() const;
+
+    long getNumCursorEvents() const;
+    long getNumQueries() const;
+    // Time from the cursor event a query answers to its result being available to drawing, in
+    // milliseconds, over the recent queries
+    double getLatencyPercentile(double percentile) const;
+    void printStatistics() const;
+};
+
+
+#endif //UNTITLED_HOVERPICKER_H
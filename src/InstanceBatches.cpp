@@ -0,0 +1,107 @@
+//
+// Groups the meshes of a frame into instanced draws of the geometry they share.
+//
+
+#include "InstanceBatches.h"
+
+#include <Eigen/Geometry>
+#include <algorithm>
+#include "RadixSort.h"
+
+using namespace std;
+
+size_t InstanceBatches::streamBytes(size_t numMeshes) {
+    return StreamBuffer::paddedBytes(numMeshes * sizeof(InstanceAttributes));
+}
+
+int& InstanceBatches::findIndex(const Geometry* geometry, int renderType) {
+    // Fibonacci hashing of the pointer and render type, the table size is a power of two
+    uint64_t hash = ((uint64_t) (uintptr_t) geometry ^ (uint64_t) (renderType + 1) << 56) * 0x9E3779B97F4A7C15ull;
+    const size_t mask = slots.size() - 1;
+    for (size_t slot = (size_t) (hash >> 32) & mask; ; slot = (slot + 1) & mask) {
+        Slot& entry = slots[slot];
+        if (entry.geometry == nullptr) {
+            entry.geometry = geometry;
+            entry.renderType = renderType;
+            entry.index = -1;
+            return entry.index;
+        }
+        if (entry.geometry == geometry && entry.renderType == renderType) {
+            return entry.index;
+        }
+    }
+}
+
+void InstanceBatches::build(const MeshList& meshes, const function<Vector3f(int)>& color,
+                            const function<bool(int)>& isStreamed, const Matrix4f& view, StreamBuffer& stream) {
+    batches.clear();
+    instances.resize(meshes.size());
+    // Every mesh adds at most a batch and a geometry, which keeps the table at most half full
+    size_t numSlots = 1;
+    while (numSlots < 4 * meshes.size()) {
+        numSlots *= 2;
+    }
+    slots.resize(max(slots.size(), numSlots));
+    fill(slots.begin(), slots.end(), Slot{nullptr, NO_RENDER_TYPE, -1});
+    int numGeometries = 0;
+    for (int meshIndex = 0; meshIndex < (int) meshes.size(); meshIndex++) {
+        const Mesh& mesh = meshes[meshIndex];
+        const Geometry* geometry = mesh.getGeometry().get();
+        bool streamed = isStreamed(meshIndex);
+        int batchIndex = (int) batches.size();
+        if (!streamed) {
+            int& index = findIndex(geometry, mesh.getRenderType());
+            if (index == -1) {
+                index = batchIndex;
+            }
+            batchIndex = index;
+        }
+        Vector3f center = (mesh.getBoundsMin() + mesh.getBoundsMax()) / 2;
+        float depth = -view.row(2).dot(mesh.getModel() * center.homogeneous());
+        if (batchIndex == (int) batches.size()) {
+            Batch batch;
+            batch.geometry = mesh.getGeometry();
+            int& geometryIndex = findIndex(geometry, NO_RENDER_TYPE);
+            if (geometryIndex == -1) {
+                geometryIndex = numGeometries++;
+            }
+            batch.geometryIndex = geometryIndex;
+            batch.renderType = mesh.getRenderType();
+            batch.streamedMeshIndex = streamed ? meshIndex : -1;
+            batch.instancesOffset = 0;
+            batch.numInstances = 0;
+            batch.depth = depth;
+            batches.push_back(batch);
+        }
+        Batch& batch = batches[batchIndex];
+        batch.numInstances++;
+        batch.depth = min(batch.depth, depth);
+        instances[meshIndex].key = (uint64_t) batchIndex << 32 | orderedFloatBits(depth);
+        instances[meshIndex].meshIndex = meshIndex;
+    }
+    if (meshes.empty()) {
+        return;
+    }
+
+    // Batch by batch in the order they were found, nearest instances first
+    radixSort(instances, scratch);
+    GLintptr offset;
+    InstanceAttributes* attributes = (InstanceAttributes*) stream.map(sizeof(InstanceAttributes) * meshes.size(), offset);
+    int first = 0;
+    for (Batch& batch : batches) {
+        batch.instancesOffset = offset + sizeof(InstanceAttributes) * first;
+        first += batch.numInstances;
+    }
+    for (size_t instance = 0; instance < instances.size(); instance++) {
+        const Mesh& mesh = meshes[instances[instance].meshIndex];
+        InstanceAttributes& instanceAttributes = attributes[instance];
+        Map<Matrix4f>(instanceAttributes.model) = mesh.getModel();
+        Map<Matrix3f>(instanceAttributes.normalModel) = mesh.getInverseModel().topLeftCorner<3, 3>().transpose();
+        Map<Vector4f>(instanceAttributes.color) << color(instances[instance].meshIndex), 1.0f;
+    }
+    stream.unmap();
+}
+
+const vector<InstanceBatches::Batch>& InstanceBatches::getBatches() const {
+    return batches;
+}
@@ -0,0 +1,81 @@
+//
+// Groups the meshes of a frame into instanced draws of the geometry they share.
+//
+
+#ifndef UNTITLED_INSTANCEBATCHES_H
+#define UNTITLED_INSTANCEBATCHES_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Mesh.h"
+#include "StreamBuffer.h"
+
+// Meshes with the same geometry and render type become one batch, drawn with a single instanced
+// call. The per instance inputs of all meshes are written to a stream buffer every frame, batch by
+// batch, so every batch reads a contiguous range, with its instances from front to back. Meshes
+// whose vertices are streamed are batches of their own.
+class InstanceBatches {
+public:
+    // Per instance inputs of the shader, tightly packed floats
+    struct InstanceAttributes {
+        float model[16];
+        // Inverse transpose of the upper 3x3 of model, transforms the normals
+        float normalModel[9];
+        float color[4];
+    };
+
+    struct Batch {
+        std::shared_ptr<const Geometry> geometry;
+        // Numbers the distinct geometries of the frame from 0
+        int geometryIndex;
+        RenderType renderType;
+        // The only mesh of the batch if its vertices are streamed, -1 otherwise
+        int streamedMeshIndex;
+        // Of the attributes of the first instance in the stream buffer
+        GLintptr instancesOffset;
+        int numInstances;
+        // View space depth of the center of the nearest instance
+        float depth;
+    };
+
+private:
+    // Key of batch index and depth, for sorting the instances
+    struct Instance {
+        uint64_t key;
+        int meshIndex;
+    };
+
+    // Of an open addressing table from a geometry and render type to the index of its batch, or
+    // from a geometry and NO_RENDER_TYPE to its geometry index. Kept between frames, so a frame
+    // only allocates when it has more meshes than any before.
+    struct Slot {
+        const Geometry* geometry;
+        int renderType;
+        int index;
+    };
+    static const int NO_RENDER_TYPE = -1;
+
+    std::vector<Batch> batches;
+    std::vector<Instance> instances;
+    std::vector<Instance> scratch;
+    std::vector<Slot> slots;
+
+    // Index stored for the key, -1 if it was not there before
+    int& findIndex(const Geometry* geometry, int renderType);
+
+public:
+    // Bytes that build writes into the stream buffer for numMeshes meshes
+    static size_t streamBytes(size_t numMeshes);
+
+    // Groups meshes and writes their instance attributes into stream, with the colors given by
+    // color. isStreamed tells which meshes have to be drawn on their own. Depth is along the
+    // viewing direction of the view matrix.
+    void build(const MeshList& meshes, const std::function<Vector3f(int)>& color,
+               const std::function<bool(int)>& isStreamed, const Matrix4f& view, StreamBuffer& stream);
+
+    const std::vector<Batch>& getBatches() const;
+};
+
+
+#endif //UNTITLED_INSTANCEBATCHES_H
@@ -0,0 +1,108 @@
+//
+// Read-only memory mapping of a whole file.
+//
+
+#include "MappedFile.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filePath) {
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Error opening data file: " + filePath);
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    this->fileHandle = file;
+    this->length = (size_t) fileSize.QuadPart;
+    if (this->length == 0) {
+        return;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        unmap();
+        throw std::runtime_error("Error mapping data file: " + filePath);
+    }
+    this->mappingHandle = mapping;
+    this->data = (const char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (this->data == nullptr) {
+        unmap();
+        throw std::runtime_error("Error mapping data file: " + filePath);
+    }
+}
+
+void MappedFile::unmap() {
+    if (data != nullptr) UnmapViewOfFile(data);
+    if (mappingHandle != nullptr) CloseHandle((HANDLE) mappingHandle);
+    if (fileHandle != nullptr) CloseHandle((HANDLE) fileHandle);
+    data = nullptr;
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+    length = 0;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filePath) {
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Error opening data file: " + filePath);
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        throw std::runtime_error("Error reading data file: " + filePath);
+    }
+    this->length = (size_t) fileStat.st_size;
+    if (this->length == 0) {
+        close(fd);
+        return;
+    }
+
+    void* mapped = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        this->length = 0;
+        throw std::runtime_error("Error mapping data file: " + filePath);
+    }
+    madvise(mapped, this->length, MADV_SEQUENTIAL);
+    this->data = (const char*) mapped;
+}
+
+void MappedFile::unmap() {
+    if (data != nullptr) munmap((void*) data, length);
+    data = nullptr;
+    length = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+    unmap();
+}
+
+const char* MappedFile::begin() const {
+    return data;
+}
+
+const char* MappedFile::end() const {
+    return data + length;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
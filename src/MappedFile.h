@@ -0,0 +1,36 @@
+//
+// Read-only memory mapping of a whole file.
+//
+
+#ifndef UNTITLED_MAPPEDFILE_H
+#define UNTITLED_MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+
+    void unmap();
+
+public:
+    // Maps the whole file, throws std::runtime_error if it cannot be opened or mapped
+    explicit MappedFile(const std::string& filePath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* begin() const;
+    const char* end() const;
+    size_t size() const;
+};
+
+
+#endif //UNTITLED_MAPPEDFILE_H
@@ -4,12 +4,11 @@
 
 #include "Mesh.h"
 #include <iostream>
-#include <fstream>
 #include <Eigen/Core>
 #include <Eigen/Dense>
 #include <vector>
 #include "Utils.h"
-#include <unordered_map>
+#include "AssetRegistry.h"
 
 using namespace std;
 using namespace Eigen;
@@ -18,25 +17,21 @@ Mesh::Mesh() {
 
 }
 
-Mesh::Mesh(const MatrixXf& vertices, const MatrixXf& faces):
-        Mesh(vertices, faces, Eigen::Vector3f(0.0, 1.1, 2.2), WIREFRAME) {
-}
-
-Mesh::Mesh(const MatrixXf &vertices, const MatrixXf &faces, const Vector3f& color, const RenderType& renderType) {
-    this->vertices = vertices;
-    this->faces = faces;
-    this->model = MatrixXf(4, 4);
-    this->model <<  1,    0.,   0.,   0.,
-            0.,   1,    0.,   0.,
-            0.,   0.,   1,    0.,
-            0.,   0.,   0.,   1.;
+Mesh::Mesh(const shared_ptr<const Geometry>& geometry, const Vector3f& color, const RenderType& renderType) {
+    this->geometry = geometry;
+    this->model = Matrix4f::Identity();
+    this->inverseModel = Matrix4f::Identity();
 
     this->color = color;
     this->renderType = renderType;
+}
 
-    this->triangleVertices = calculateTriangleVertices(faces, vertices);
-    this->faceNormals = calculateFaceNormals(faces, vertices, this->triangleVertices);
-    this->vertexNormals = calculateVertexNormals(faces, vertices, this->triangleVertices, this->faceNormals);
+Mesh::Mesh(const Matrix3Xf& vertices, const Matrix3Xu& faces):
+        Mesh(vertices, faces, Eigen::Vector3f(0.0, 1.1, 2.2), WIREFRAME) {
+}
+
+Mesh::Mesh(const Matrix3Xf &vertices, const Matrix3Xu &faces, const Vector3f& color, const RenderType& renderType):
+        Mesh(make_shared<Geometry>(vertices, faces), color, renderType) {
 }
 
 Mesh Mesh::fromOffFile(const string &filePath) {
@@ -44,146 +39,24 @@ Mesh Mesh::fromOffFile(const string &filePath) {
 }
 
 Mesh Mesh::fromOffFile(const string& filepath, const Vector3f& color, const RenderType& renderType) {
-    ifstream inputFile;
-    inputFile.open(filepath);
-
-    if (!inputFile) {
-        throw std::runtime_error("Error opening data file: " + filepath);
-    } else {
-        string line;
-        getline(inputFile, line);
-        getline(inputFile, line);
-        vector<string> meta = Utils::splitString(line, " ");
-        int numVertices = stoi(meta.at(0));
-        int numFaces = stoi(meta.at(1));
-
-        MatrixXf vertices = MatrixXf::Zero(3, numVertices);
-        for (int i = 0; i < numVertices; i++) {
-            getline(inputFile, line);
-            vector<string> vertexString = Utils::splitString(line, " ");
-
-            vertices(0, i) = (stof(vertexString[0]));
-            vertices(1, i) = (stof(vertexString[1]));
-            vertices(2, i) = stof(vertexString[2]);
-        }
-
-        MatrixXf faces = MatrixXf::Zero(3, numFaces);
-        for (int i = 0; i < numFaces; i++) {
-            getline(inputFile, line);
-            vector<string> faceString = Utils::splitString(line, " ");
-
-            faces(0, i) = stoi(faceString[1]);
-            faces(1, i) = stoi(faceString[2]);
-            faces(2, i) = stoi(faceString[3]);
-        }
-        inputFile.close();
-
-        Vector3f baryCenter = calculateBarycenter(faces, vertices);
-        for (long i = 0; i < vertices.cols(); i++) {
-            vertices.col(i) << vertices.col(i) - baryCenter;
-        }
-        return Mesh(vertices, faces, color, renderType);
-    }
-}
-
-Vector3f Mesh::calculateBarycenter(const MatrixXf &faces, const MatrixXf &vertices) {
-    Vector3f centroid(0., 0., 0.);
-    for (long faceNumber = 0; faceNumber < faces.cols(); faceNumber++) {
-        const Vector3f& a = vertices.col(faces(0, faceNumber));
-        const Vector3f& b = vertices.col(faces(1, faceNumber));
-        const Vector3f& c = vertices.col(faces(2, faceNumber));
-
-        const Vector3f& center = (a + b + c) / 3;
-        centroid = centroid + center;
-    }
-    return centroid / faces.cols();
+    return Mesh(AssetRegistry::shared().load(filepath), color, renderType);
 }
 
-MatrixXf Mesh::calculateTriangleVertices(const MatrixXf &faces, const MatrixXf &vertices) {
-    MatrixXf triangleVertices = MatrixXf::Zero(3, faces.cols() * faces.rows());
-    for (long faceNumber = 0; faceNumber < faces.cols(); faceNumber++) {
-        for (long faceVertexNumber = 0; faceVertexNumber < faces.rows(); faceVertexNumber++) {
-            int vertexNumber = faces(faceVertexNumber, faceNumber);
-            triangleVertices.col((faces.rows()*faceNumber) + faceVertexNumber) << vertices.col(vertexNumber);
-        }
-    }
-    return triangleVertices;
+Mesh Mesh::box(const Vector3f& boundsMin, const Vector3f& boundsMax, const Vector3f& color,
+               const RenderType& renderType) {
+    return Mesh(Geometry::box(boundsMin, boundsMax), color, renderType);
 }
 
-MatrixXf Mesh::calculateFaceNormals(const MatrixXf& faces, const MatrixXf& vertices, MatrixXf triangleVertices) {
-    MatrixXf normals = MatrixXf::Zero(3, triangleVertices.cols());
-    for (long i = 0; i < triangleVertices.cols(); i += 3) {
-        Vector3f a = triangleVertices.col(i);
-        Vector3f b = triangleVertices.col(i + 1);
-        Vector3f c = triangleVertices.col(i + 2);
-
-        Vector3f normal = ((b - a).cross(c - a)).normalized();
-        normals.col(i) << normal;
-        normals.col(i + 1) << normal;
-        normals.col(i + 2) << normal;
-    }
-    return normals;
+void Mesh::scaleToUnitCube() {
+    scale(getUnitCubeScale());
 }
 
-MatrixXf Mesh::calculateVertexNormals(const MatrixXf& faces, const MatrixXf& vertices, const MatrixXf& triangleVertices,
-        const MatrixXf& faceNormals) {
-
-    unordered_map<int, vector<int>> vertexNumberToFaceNumbersMap;
-    for (long faceNumber = 0; faceNumber < faces.cols(); faceNumber++) {
-        for (long faceVertexNumber = 0; faceVertexNumber < faces.rows(); faceVertexNumber++) {
-            int vertexNumber = faces(faceVertexNumber, faceNumber);
-            if (vertexNumberToFaceNumbersMap.find(vertexNumber) == vertexNumberToFaceNumbersMap.end()) {
-                vertexNumberToFaceNumbersMap[vertexNumber] = std::vector<int>();
-            }
-            vertexNumberToFaceNumbersMap[vertexNumber].push_back(faceNumber);
-        }
-    }
-
-    MatrixXf normals(3, triangleVertices.cols());
-    for (long faceNumber = 0; faceNumber < faces.cols(); faceNumber++) {
-        for (long faceVertexNumber = 0; faceVertexNumber < faces.rows(); faceVertexNumber++) {
-            int vertexNumber = faces(faceVertexNumber, faceNumber);
-            vector<int> facesAdjascentToVertex =  vertexNumberToFaceNumbersMap[vertexNumber];
-            Vector3f vertexNormal(0.0, 0.0, 0.0);
-            for (int face: facesAdjascentToVertex) {
-                Vector3f faceNormal = faceNormals.col(face*3);
-                vertexNormal += faceNormal;
-            }
-            normals.col((3*faceNumber) + faceVertexNumber) = vertexNormal.normalized();
-        }
-    }
-    return normals;
+float Mesh::getUnitCubeScale() const {
+    Vector3f extent = geometry->getBoundsMax() - geometry->getBoundsMin();
+    return 1 / extent.maxCoeff();
 }
 
-void Mesh::scaleToUnitCube() {
-    float xmax = -999999, xmin = 99999;
-    float ymax = -999999, ymin = 99999;
-    float zmax = -999999, zmin = 99999;
-    for (long i = 0; i < getVertices().cols(); i++) {
-        Vector3f vertex = getVertices().col(i);
-        if (vertex(0) < xmin) {
-            xmin = vertex(0);
-        }
-        if (vertex(0) > xmax) {
-            xmax = vertex(0);
-        }
-        if (vertex(1) < ymin) {
-            ymin = vertex(1);
-        }
-        if (vertex(1) > ymax) {
-            ymax = vertex(1);
-        }
-        if (vertex(2) < zmin) {
-            zmin = vertex(2);
-        }
-        if (vertex(2) > zmax) {
-            zmax = vertex(2);
-        }
-    }
-    scale(1 / max(max(xmax-xmin, ymax-ymin), zmax-zmin));
-}
-
-RenderType Mesh::getRenderType() {
+RenderType Mesh::getRenderType() const {
     return renderType;
 }
 
@@ -191,7 +64,7 @@ void Mesh::setRenderType(const RenderType& renderType) {
     this->renderType = renderType;
 }
 
-Vector3f Mesh::getColor() {
+const Vector3f& Mesh::getColor() const {
     return this->color;
 }
 
@@ -199,45 +72,109 @@ void Mesh::setColor(const Vector3f &color) {
     this->color = color;
 }
 
+void Mesh::setModel(const Matrix4f& model) {
+    this->model = model;
+    this->inverseModel = model.inverse();
+}
+
 void Mesh::translate(const Vector3f& translateBy) {
-    this->model << Utils::generateTranslationMatrix(translateBy) * this->model;
+    setModel(Utils::generateTranslationMatrix(translateBy) * this->model);
 }
 
 void Mesh::scale(float factor) {
-    this->model << Utils::generateScaleAboutPointMatrix(getTranslation(), factor) * this->model;
+    setModel(Utils::generateScaleAboutPointMatrix(getTranslation(), factor) * this->model);
 }
 
 void Mesh::rotate(int axis, float radians) {
-    this->model << Utils::generateRotateAboutPointMatrix(axis, radians, getTranslation()) * this->model;
+    setModel(Utils::generateRotateAboutPointMatrix(axis, radians, getTranslation()) * this->model);
 }
 
-Vector3f Mesh::getTranslation() {
-    auto res = Vector3f(this->model.block(0, 3, 3, 1));
-    return res;
+bool Mesh::intersect(const Vector3f& origin, const Vector3f& direction, RayHit& hit) const {
+    Vector3f objectOrigin = (inverseModel * origin.homogeneous()).head<3>();
+    Vector3f objectDirection = inverseModel.topLeftCorner<3, 3>() * direction;
+    // Object space length of one step of t, which converts distances between the two spaces
+    float objectStep = objectDirection.norm();
+    if (objectStep == 0.0f) {
+        return false;
+    }
+
+    RayHit objectHit = hit;
+    objectHit.t = hit.t * objectStep;
+    if (!geometry->intersect(objectOrigin, objectDirection / objectStep, objectHit)) {
+        return false;
+    }
+    hit = objectHit;
+    hit.t = objectHit.t / objectStep;
+    return true;
+}
+
+bool Mesh::intersects(const SelectionFrustum& frustum, bool testTriangles) const {
+    SelectionFrustum objectFrustum = frustum.transformed(model);
+    if (!testTriangles) {
+        return objectFrustum.classifyBounds(geometry->getBoundsMin(), geometry->getBoundsMax()) != Bvh::DISJOINT;
+    }
+
+    const Matrix3Xf& vertices = geometry->getVertices();
+    const Matrix3Xu& faces = geometry->getFaces();
+    bool found = false;
+    geometry->getBvh().query([&](const Vector3f& boundsMin, const Vector3f& boundsMax) {
+        return objectFrustum.classifyBounds(boundsMin, boundsMax);
+    }, [&](uint32_t face, bool contained) {
+        found = contained || objectFrustum.intersectsTriangle(vertices.col(faces(0, face)),
+                                                              vertices.col(faces(1, face)),
+                                                              vertices.col(faces(2, face)));
+        return !found;
+    });
+    return found;
 }
 
-MatrixXf Mesh::getVertices() {
-    return this->vertices;
+Vector3f Mesh::getTranslation() const {
+    return this->model.block<3, 1>(0, 3);
 }
 
-MatrixXf Mesh::getFaces() {
-    return this->faces;
+const shared_ptr<const Geometry>& Mesh::getGeometry() const {
+    return this->geometry;
 }
 
-MatrixXf Mesh::getModel() {
+const Matrix3Xf& Mesh::getVertices() const {
+    return geometry->getVertices();
+}
+
+const Matrix3Xu& Mesh::getFaces() const {
+    return geometry->getFaces();
+}
+
+const Matrix4f& Mesh::getModel() const {
     return this->model;
 }
 
-MatrixXf Mesh::getTriangleVertices() {
-    return this->triangleVertices;
+const Matrix4f& Mesh::getInverseModel() const {
+    return this->inverseModel;
+}
+
+const Vector3f& Mesh::getBoundsMin() const {
+    return geometry->getBoundsMin();
+}
+
+const Vector3f& Mesh::getBoundsMax() const {
+    return geometry->getBoundsMax();
+}
+
+void Mesh::getWorldBounds(Vector3f& boundsMin, Vector3f& boundsMax) const {
+    Vector3f center = (geometry->getBoundsMin() + geometry->getBoundsMax()) / 2;
+    Vector3f halfExtent = (geometry->getBoundsMax() - geometry->getBoundsMin()) / 2;
+    Vector3f worldCenter = (model * center.homogeneous()).head<3>();
+    Vector3f worldHalfExtent = model.topLeftCorner<3, 3>().cwiseAbs() * halfExtent;
+    boundsMin = worldCenter - worldHalfExtent;
+    boundsMax = worldCenter + worldHalfExtent;
 }
 
-MatrixXf Mesh::getFaceNormals() {
-    return this->faceNormals;
+const Matrix3Xf& Mesh::getVertexNormals() const {
+    return geometry->getVertexNormals();
 }
 
-MatrixXf Mesh::getVertexNormals() {
-    return this->vertexNormals;
+const Adjacency& Mesh::getAdjacency() const {
+    return geometry->getAdjacency();
 }
 
 Mesh::~Mesh() {
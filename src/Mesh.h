@@ -6,58 +6,86 @@
 #define UNTITLED_MESH_H
 
 #include <Eigen/Core>
+#include <memory>
+#include <vector>
 #include "Utils.h"
+#include "Geometry.h"
+#include "OffParser.h"
+#include "SelectionFrustum.h"
 
 using namespace Eigen;
 using namespace std;
 
+// A placed instance of a Geometry. Instances of the same asset share one Geometry and only
+// hold their own transformation, color and render type.
 class Mesh {
 private:
-    MatrixXf vertices;
-    MatrixXf faces;
-    MatrixXf triangleVertices;
-    MatrixXf faceNormals;
-    MatrixXf vertexNormals;
+    shared_ptr<const Geometry> geometry;
 
-    MatrixXf model;
+    Matrix4f model;
+    // Kept in step with model so ray queries do not invert it per pick
+    Matrix4f inverseModel;
     Vector3f color;
     RenderType renderType;
 
-    static MatrixXf calculateTriangleVertices(const MatrixXf& faces, const MatrixXf& vertices);
-    static MatrixXf calculateFaceNormals(const MatrixXf& faces, const MatrixXf& vertices, MatrixXf triangleVertices);
-    static MatrixXf calculateVertexNormals(const MatrixXf& faces, const MatrixXf& vertices,
-            const MatrixXf& triangleVertices, const MatrixXf& faceNormals);
-    static Vector3f calculateBarycenter(const MatrixXf& faces, const MatrixXf& vertices);
-
 public:
+    // model is a fixed size vectorizable member, so heap allocated meshes must be aligned
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
     Mesh();
-    Mesh(const MatrixXf& vertices, const MatrixXf& faces, const Vector3f& color, const RenderType& renderType);
-    Mesh(const MatrixXf& vertices, const MatrixXf& faces);
+    Mesh(const shared_ptr<const Geometry>& geometry, const Vector3f& color, const RenderType& renderType);
+    Mesh(const Matrix3Xf& vertices, const Matrix3Xu& faces, const Vector3f& color, const RenderType& renderType);
+    Mesh(const Matrix3Xf& vertices, const Matrix3Xu& faces);
     ~Mesh();
+    // Loads through AssetRegistry::shared(), so every mesh of the same file shares its geometry
     static Mesh fromOffFile(const string& filePath);
     static Mesh fromOffFile(const string& filePath, const Vector3f& color, const RenderType& renderType);
+    // Axis aligned box, used as a stand-in while the real mesh is loading
+    static Mesh box(const Vector3f& boundsMin, const Vector3f& boundsMax, const Vector3f& color,
+            const RenderType& renderType);
 
     void translate(const Vector3f& translateBy);
     void scale(float factor);
     void rotate(int axis, float radians);
 
     void scaleToUnitCube();
+    float getUnitCubeScale() const;
 
-    Vector3f getTranslation();
+    Vector3f getTranslation() const;
 
-    MatrixXf getVertices();
-    MatrixXf getFaces();
-    MatrixXf getTriangleVertices();
-    MatrixXf getFaceNormals();
-    MatrixXf getVertexNormals();
-    MatrixXf getModel();
-    Vector3f getColor();
-    RenderType getRenderType();
+    // The accessors return references into the mesh and its shared geometry, so reading a
+    // mesh never copies it. They stay valid while the mesh is alive and unmodified.
+    const shared_ptr<const Geometry>& getGeometry() const;
+    const Matrix3Xf& getVertices() const;
+    const Matrix3Xu& getFaces() const;
+    const Matrix3Xf& getVertexNormals() const;
+    // Shared by every mesh of the same geometry
+    const Adjacency& getAdjacency() const;
+    const Matrix4f& getModel() const;
+    const Matrix4f& getInverseModel() const;
+    const Vector3f& getBoundsMin() const;
+    const Vector3f& getBoundsMax() const;
+    // Axis aligned box around the transformed bounds, which contains the transformed mesh
+    void getWorldBounds(Vector3f& boundsMin, Vector3f& boundsMax) const;
+    const Vector3f& getColor() const;
+    RenderType getRenderType() const;
 
     void setRenderType(const RenderType& renderType);
     void setColor(const Vector3f& color);
-    float getMaxDistanceFromCenter();
+    void setModel(const Matrix4f& model);
+
+    // Closest hit of the world space ray origin + t * direction with this mesh, if it is closer than
+    // hit.t. The ray is moved into object space once and intersected there with a unit direction,
+    // and the hit distance is mapped back, so hit.t stays comparable across meshes.
+    bool intersect(const Vector3f& origin, const Vector3f& direction, RayHit& hit) const;
+    // Whether the mesh is inside the selection region, in part or whole. Either its bounds are tested
+    // or, with testTriangles, its triangles through the hierarchy of its geometry.
+    bool intersects(const SelectionFrustum& frustum, bool testTriangles) const;
+    float getMaxDistanceFromCenter() const;
 };
 
+// Meshes stored by value need the aligned allocator, see EIGEN_MAKE_ALIGNED_OPERATOR_NEW above
+typedef std::vector<Mesh, Eigen::aligned_allocator<Mesh>> MeshList;
+
 
 #endif //UNTITLED_MESH_H
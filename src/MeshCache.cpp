@@ -0,0 +1,196 @@
+//
+// Binary sidecar cache (<source>.meshbin) holding a geometry with all of its derived data.
+//
+
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "Utils.h"
+
+#include <cstdio>
+#include <iostream>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const char MAGIC[8] = {'M', 'E', 'S', 'H', 'B', 'I', 'N', '\0'};
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t sourceSize;
+    int64_t sourceModifiedTime;
+    uint64_t numVertices;
+    uint64_t numFaces;
+    // numVertices when the ambient occlusion has been baked, otherwise 0
+    uint64_t numOcclusionValues;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint64_t payloadSize;
+    uint64_t payloadHash;
+};
+
+// Payload layout, every array is tightly packed and column major:
+//   float    vertices[3 * numVertices]
+//   uint32_t indices[3 * numFaces]
+//   float    vertexNormals[3 * numVertices]
+//   float    ambientOcclusion[numOcclusionValues]
+uint64_t payloadSizeFor(uint64_t numVertices, uint64_t numFaces, uint64_t numOcclusionValues) {
+    return 2 * sizeof(float) * 3 * numVertices + sizeof(uint32_t) * 3 * numFaces
+            + sizeof(float) * numOcclusionValues;
+}
+
+// Reads the header of the cache for sourcePath and checks that it belongs to the current source file
+bool readHeader(const std::string& sourcePath, const std::string& cachePath, MeshCacheHeader& header) {
+    uint64_t sourceSize;
+    int64_t sourceModifiedTime;
+    if (!Utils::getFileStamp(sourcePath, sourceSize, sourceModifiedTime)) {
+        return false;
+    }
+    FILE* file = fopen(cachePath.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool complete = fread(&header, sizeof(header), 1, file) == 1;
+    fclose(file);
+    if (!complete || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != MeshCache::VERSION
+            || header.headerSize != sizeof(MeshCacheHeader)) {
+        return false;
+    }
+    if (header.sourceSize != sourceSize || header.sourceModifiedTime != sourceModifiedTime) {
+        std::cerr << "Mesh cache is stale: " << cachePath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename Matrix>
+const char* copyOut(const char* from, Matrix& to, long cols) {
+    const size_t size = sizeof(typename Matrix::Scalar) * Matrix::RowsAtCompileTime * cols;
+    to.resize(Matrix::RowsAtCompileTime, cols);
+    memcpy(to.data(), from, size);
+    return from + size;
+}
+
+}
+
+std::string MeshCache::cachePathFor(const std::string& sourcePath) {
+    return sourcePath + ".meshbin";
+}
+
+std::shared_ptr<const Geometry> MeshCache::read(const std::string& sourcePath) {
+    const std::string cachePath = cachePathFor(sourcePath);
+    MeshCacheHeader header;
+    if (!readHeader(sourcePath, cachePath, header)) {
+        return nullptr;
+    }
+
+    try {
+        MappedFile file(cachePath);
+        // The header is read again from the mapping in case the file was replaced in between
+        if (file.size() < sizeof(MeshCacheHeader) || memcmp(file.begin(), &header, sizeof(header)) != 0) {
+            return nullptr;
+        }
+        if ((header.numOcclusionValues != 0 && header.numOcclusionValues != header.numVertices)
+                || header.payloadSize != payloadSizeFor(header.numVertices, header.numFaces, header.numOcclusionValues)
+                || file.size() != sizeof(MeshCacheHeader) + header.payloadSize) {
+            std::cerr << "Mesh cache is truncated: " << cachePath << std::endl;
+            return nullptr;
+        }
+        const char* payload = file.begin() + sizeof(MeshCacheHeader);
+        if (Utils::hashBytes(payload, header.payloadSize) != header.payloadHash) {
+            std::cerr << "Mesh cache failed its checksum: " << cachePath << std::endl;
+            return nullptr;
+        }
+
+        long numVertices = (long) header.numVertices;
+        long numFaces = (long) header.numFaces;
+        Matrix3Xf vertices, vertexNormals;
+        Matrix3Xu faces;
+        const char* p = copyOut(payload, vertices, numVertices);
+        p = copyOut(p, faces, numFaces);
+        p = copyOut(p, vertexNormals, numVertices);
+
+        std::shared_ptr<Geometry> geometry(new Geometry(
+                vertices, faces, vertexNormals,
+                Vector3f(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]),
+                Vector3f(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2])));
+        geometry->sourcePath = sourcePath;
+        if (header.numOcclusionValues != 0) {
+            std::shared_ptr<RowVectorXf> ambientOcclusion = std::make_shared<RowVectorXf>();
+            copyOut(p, *ambientOcclusion, (long) header.numOcclusionValues);
+            geometry->setAmbientOcclusion(ambientOcclusion);
+        }
+        return geometry;
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+bool MeshCache::readBounds(const std::string& sourcePath, Vector3f& boundsMin, Vector3f& boundsMax) {
+    MeshCacheHeader header;
+    if (!readHeader(sourcePath, cachePathFor(sourcePath), header)) {
+        return false;
+    }
+    boundsMin = Vector3f(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    boundsMax = Vector3f(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    return true;
+}
+
+bool MeshCache::write(const std::string& sourcePath, const Geometry& geometry) {
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.headerSize = sizeof(MeshCacheHeader);
+    if (!Utils::getFileStamp(sourcePath, header.sourceSize, header.sourceModifiedTime)) {
+        return false;
+    }
+    header.numVertices = (uint64_t) geometry.vertices.cols();
+    header.numFaces = (uint64_t) geometry.faces.cols();
+    for (int i = 0; i < 3; i++) {
+        header.boundsMin[i] = geometry.boundsMin(i);
+        header.boundsMax[i] = geometry.boundsMax(i);
+    }
+    std::shared_ptr<const RowVectorXf> ambientOcclusion = geometry.getAmbientOcclusion();
+    header.numOcclusionValues = ambientOcclusion ? (uint64_t) ambientOcclusion->size() : 0;
+    header.payloadSize = payloadSizeFor(header.numVertices, header.numFaces, header.numOcclusionValues);
+
+    std::vector<char> payload(header.payloadSize);
+    char* p = payload.data();
+    memcpy(p, geometry.vertices.data(), sizeof(float) * geometry.vertices.size());
+    p += sizeof(float) * geometry.vertices.size();
+    memcpy(p, geometry.faces.data(), sizeof(uint32_t) * geometry.faces.size());
+    p += sizeof(uint32_t) * geometry.faces.size();
+    memcpy(p, geometry.vertexNormals.data(), sizeof(float) * geometry.vertexNormals.size());
+    p += sizeof(float) * geometry.vertexNormals.size();
+    if (ambientOcclusion) {
+        memcpy(p, ambientOcclusion->data(), sizeof(float) * ambientOcclusion->size());
+    }
+    header.payloadHash = Utils::hashBytes(payload.data(), payload.size());
+
+    // Write next to the destination and rename, so a reader never sees a half written cache
+    const std::string cachePath = cachePathFor(sourcePath);
+    const std::string temporaryPath = cachePath + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Could not write mesh cache: " << cachePath << std::endl;
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+            && fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        remove(temporaryPath.c_str());
+        std::cerr << "Could not write mesh cache: " << cachePath << std::endl;
+        return false;
+    }
+    remove(cachePath.c_str());
+    if (rename(temporaryPath.c_str(), cachePath.c_str()) != 0) {
+        remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+//
+// Binary sidecar cache (<source>.meshbin) holding a geometry with all of its derived data.
+//
+
+#ifndef UNTITLED_MESHCACHE_H
+#define UNTITLED_MESHCACHE_H
+
+#include "Geometry.h"
+#include <memory>
+#include <string>
+
+class MeshCache {
+public:
+    static const uint32_t VERSION = 3;
+
+    static std::string cachePathFor(const std::string& sourcePath);
+
+    // Restores the geometry from the cache next to sourcePath. Returns null if there is no cache,
+    // or if it was written for a different version of the source or fails its checksum.
+    static std::shared_ptr<const Geometry> read(const std::string& sourcePath);
+
+    // Reads only the bounds from the header of an up to date cache, without verifying the payload
+    static bool readBounds(const std::string& sourcePath, Vector3f& boundsMin, Vector3f& boundsMax);
+
+    // Writes the cache next to sourcePath, with the ambient occlusion of the geometry if it has been
+    // baked, so it is written again once a bake has finished. Failing to write is not an error, the mesh is simply parsed again next time.
+    static bool write(const std::string& sourcePath, const Geometry& geometry);
+};
+
+
+#endif //UNTITLED_MESHCACHE_H
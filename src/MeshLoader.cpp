@@ -0,0 +1,89 @@
+//
+// Loads meshes on worker threads and hands them back to the main thread once per frame.
+//
+
+#include "MeshLoader.h"
+#include "AssetRegistry.h"
+
+#include <algorithm>
+
+MeshLoadRequest::MeshLoadRequest(const std::string& filePath) : filePath(filePath), progress(0.0f), cancelled(false) {
+}
+
+const std::string& MeshLoadRequest::getFilePath() const {
+    return filePath;
+}
+
+float MeshLoadRequest::getProgress() const {
+    return progress;
+}
+
+void MeshLoadRequest::cancel() {
+    cancelled = true;
+}
+
+bool MeshLoadRequest::isCancelled() const {
+    return cancelled;
+}
+
+MeshLoader::MeshLoader(ThreadPool& pool) : pool(pool), queue(std::make_shared<CompletionQueue>()) {
+}
+
+std::shared_ptr<MeshLoadRequest> MeshLoader::load(const std::string& filePath, const Vector3f& color,
+                                                  const RenderType& renderType, const CompletionCallback& onCompleted) {
+    std::shared_ptr<MeshLoadRequest> request = std::make_shared<MeshLoadRequest>(filePath);
+    std::shared_ptr<CompletionQueue> queue = this->queue;
+    pending.push_back(request);
+
+    pool.submit([request, queue, color, renderType, onCompleted]() {
+        Completion completion;
+        completion.request = request;
+        completion.onCompleted = onCompleted;
+
+        // Parsing is most of the work, computing the normals takes the remaining fifth
+        OffParser::ProgressCallback onProgress = [request](float fraction) {
+            request->progress = 0.8f * fraction;
+            return !request->cancelled;
+        };
+        try {
+            if (!request->cancelled) {
+                std::shared_ptr<const Geometry> geometry = AssetRegistry::shared().load(request->filePath, onProgress);
+                if (geometry) {
+                    // Build the picking hierarchy here so the first click on the mesh does not wait for it
+                    geometry->getBvh();
+                    completion.mesh.reset(new Mesh(geometry, color, renderType));
+                }
+            }
+        } catch (const std::exception& e) {
+            cerr << e.what() << endl;
+        }
+        request->progress = 1.0f;
+
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->completed.push_back(std::move(completion));
+    });
+    return request;
+}
+
+void MeshLoader::processCompleted() {
+    std::vector<Completion> completed;
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        completed.swap(queue->completed);
+    }
+    for (Completion& completion : completed) {
+        pending.erase(std::remove(pending.begin(), pending.end(), completion.request), pending.end());
+        bool delivered = completion.mesh && !completion.request->isCancelled();
+        completion.onCompleted(delivered ? completion.mesh.get() : nullptr);
+    }
+}
+
+void MeshLoader::cancelAll() {
+    for (const std::shared_ptr<MeshLoadRequest>& request : pending) {
+        request->cancel();
+    }
+}
+
+const std::vector<std::shared_ptr<MeshLoadRequest>>& MeshLoader::getPendingRequests() const {
+    return pending;
+}
@@ -0,0 +1,76 @@
+//
+// Loads meshes on worker threads and hands them back to the main thread once per frame.
+//
+
+#ifndef UNTITLED_MESHLOADER_H
+#define UNTITLED_MESHLOADER_H
+
+#include "Mesh.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class MeshLoadRequest {
+private:
+    friend class MeshLoader;
+
+    std::string filePath;
+    std::atomic<float> progress;
+    std::atomic<bool> cancelled;
+
+public:
+    explicit MeshLoadRequest(const std::string& filePath);
+
+    const std::string& getFilePath() const;
+    // Fraction of the load done so far, between 0 and 1
+    float getProgress() const;
+    // The worker stops at its next progress check and the mesh is never delivered
+    void cancel();
+    bool isCancelled() const;
+};
+
+class MeshLoader {
+public:
+    // Called on the main thread from processCompleted. The mesh is null if loading failed or was cancelled.
+    typedef std::function<void(Mesh* mesh)> CompletionCallback;
+
+private:
+    struct Completion {
+        std::shared_ptr<MeshLoadRequest> request;
+        std::unique_ptr<Mesh> mesh;
+        CompletionCallback onCompleted;
+    };
+
+    // Shared with the worker tasks so that they never outlive it
+    struct CompletionQueue {
+        std::mutex mutex;
+        std::vector<Completion> completed;
+    };
+
+    ThreadPool& pool;
+    std::shared_ptr<CompletionQueue> queue;
+    std::vector<std::shared_ptr<MeshLoadRequest>> pending;
+
+public:
+    explicit MeshLoader(ThreadPool& pool = ThreadPool::shared());
+
+    // Starts parsing the file and computing its derived data in the background
+    std::shared_ptr<MeshLoadRequest> load(const std::string& filePath, const Vector3f& color,
+            const RenderType& renderType, const CompletionCallback& onCompleted);
+
+    // Runs the callbacks of every load that finished since the last call. Call once per frame.
+    void processCompleted();
+
+    void cancelAll();
+
+    // Loads that have not been delivered yet, for showing progress
+    const std::vector<std::shared_ptr<MeshLoadRequest>>& getPendingRequests() const;
+};
+
+
+#endif //UNTITLED_MESHLOADER_H
@@ -0,0 +1,320 @@
+//
+// Allocation free parser for OFF mesh files.
+//
+
+#include "OffParser.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using namespace Eigen;
+
+namespace {
+
+const double POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Skips whitespace, line breaks and '#' comments up to the next token
+inline void skipToToken(const char*& p, const char* end) {
+    while (p < end) {
+        char c = *p;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            p++;
+        } else if (c == '#') {
+            while (p < end && *p != '\n') p++;
+        } else {
+            return;
+        }
+    }
+}
+
+// Skips whatever is left on the current line, e.g. per face colors
+inline void skipLine(const char*& p, const char* end) {
+    const char* newline = (const char*) memchr(p, '\n', end - p);
+    p = newline == nullptr ? end : newline + 1;
+}
+
+// Slow path for numbers with more significant digits than fit in 64 bits.
+// The token is copied to the stack because the mapped file is not null terminated.
+bool parseLongFloat(const char*& p, const char* end, float& out) {
+    char buffer[128];
+    size_t length = 0;
+    while (p + length < end && length < sizeof(buffer) - 1) {
+        char c = p[length];
+        if (!(isDigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) break;
+        buffer[length++] = c;
+    }
+    buffer[length] = '\0';
+    char* parsedEnd;
+    out = strtof(buffer, &parsedEnd);
+    if (parsedEnd == buffer) return false;
+    p += parsedEnd - buffer;
+    return true;
+}
+
+bool parseFloat(const char*& p, const char* end, float& out) {
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool anyDigits = false;
+    while (p < end && isDigit(*p)) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0) digits++;
+        } else {
+            p = start;
+            return parseLongFloat(p, end, out);
+        }
+        anyDigits = true;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && isDigit(*p)) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0) digits++;
+                exponent--;
+            }
+            anyDigits = true;
+            p++;
+        }
+    }
+    if (!anyDigits) {
+        p = start;
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* exponentStart = p;
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negativeExponent = *p == '-';
+            p++;
+        }
+        if (p < end && isDigit(*p)) {
+            int value = 0;
+            while (p < end && isDigit(*p)) {
+                if (value < 10000) value = value * 10 + (*p - '0');
+                p++;
+            }
+            exponent += negativeExponent ? -value : value;
+        } else {
+            p = exponentStart;
+        }
+    }
+
+    double value = (double) mantissa;
+    if (exponent < 0 && exponent >= -22) {
+        value /= POWERS_OF_TEN[-exponent];
+    } else if (exponent > 0 && exponent <= 22) {
+        value *= POWERS_OF_TEN[exponent];
+    } else if (exponent != 0) {
+        value *= std::pow(10.0, exponent);
+    }
+    out = (float) (negative ? -value : value);
+    return true;
+}
+
+bool parseIndex(const char*& p, const char* end, long& out) {
+    if (p >= end || !isDigit(*p)) return false;
+    long value = 0;
+    while (p < end && isDigit(*p)) {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    out = value;
+    return true;
+}
+
+void fail(const char* what) {
+    throw std::runtime_error(std::string("Malformed OFF data: ") + what);
+}
+
+inline const char* findLineEnd(const char* p, const char* end) {
+    const char* newline = (const char*) memchr(p, '\n', end - p);
+    return newline == nullptr ? end : newline;
+}
+
+inline void skipSpaces(const char*& p, const char* lineEnd) {
+    while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+}
+
+// Lines that are empty or only hold a comment do not count as records
+inline bool isRecord(const char* p, const char* lineEnd) {
+    skipSpaces(p, lineEnd);
+    return p < lineEnd && *p != '#';
+}
+
+void parseVertexRecord(const char* p, const char* lineEnd, float* out) {
+    for (int k = 0; k < 3; k++) {
+        skipSpaces(p, lineEnd);
+        if (!parseFloat(p, lineEnd, out[k])) fail("bad vertex coordinate");
+    }
+}
+
+void parseFaceRecord(const char* p, const char* lineEnd, long numVertices, uint32_t* out) {
+    long corners, index;
+    skipSpaces(p, lineEnd);
+    if (!parseIndex(p, lineEnd, corners)) fail("bad face size");
+    if (corners != 3) fail("only triangle faces are supported");
+    for (int k = 0; k < 3; k++) {
+        skipSpaces(p, lineEnd);
+        if (!parseIndex(p, lineEnd, index)) fail("bad face index");
+        if (index >= numVertices) fail("face index out of range");
+        out[k] = (uint32_t) index;
+    }
+}
+
+// Parses the records held by the lines of [p, end), the first of which is record number firstRecord.
+// Records 0..V-1 are vertices and V..V+F-1 are faces. Returns the number of the next record.
+long parseRecords(const char* p, const char* end, long firstRecord, long numVertices, long numFaces,
+                  float* vertexData, uint32_t* faceData) {
+    long record = firstRecord;
+    const long numRecords = numVertices + numFaces;
+    while (p < end && record < numRecords) {
+        const char* lineEnd = findLineEnd(p, end);
+        if (isRecord(p, lineEnd)) {
+            if (record < numVertices) {
+                parseVertexRecord(p, lineEnd, vertexData + 3 * record);
+            } else {
+                parseFaceRecord(p, lineEnd, numVertices, faceData + 3 * (record - numVertices));
+            }
+            record++;
+        }
+        p = lineEnd + 1;
+    }
+    return record;
+}
+
+long countRecords(const char* p, const char* end) {
+    long records = 0;
+    while (p < end) {
+        const char* lineEnd = findLineEnd(p, end);
+        if (isRecord(p, lineEnd)) records++;
+        p = lineEnd + 1;
+    }
+    return records;
+}
+
+}
+
+bool OffParser::parse(const char* begin, const char* end, Matrix3Xf& vertices, Matrix3Xu& faces, ThreadPool* pool,
+                      const ProgressCallback& onProgress) {
+    const char* p = begin;
+    skipToToken(p, end);
+    if (end - p >= 3 && memcmp(p, "OFF", 3) == 0) {
+        p += 3;
+    }
+
+    long numVertices, numFaces, numEdges;
+    skipToToken(p, end);
+    if (!parseIndex(p, end, numVertices)) fail("missing vertex count");
+    skipToToken(p, end);
+    if (!parseIndex(p, end, numFaces)) fail("missing face count");
+    skipToToken(p, end);
+    if (!parseIndex(p, end, numEdges)) fail("missing edge count");
+    skipLine(p, end);
+    if (numVertices > (long) UINT32_MAX) fail("too many vertices for 32 bit indices");
+
+    vertices.resize(3, numVertices);
+    faces.resize(3, numFaces);
+    const long numRecords = numVertices + numFaces;
+    float* vertexData = vertices.data();
+    uint32_t* faceData = faces.data();
+    const bool parallel = pool != nullptr && pool->size() > 1;
+
+    // Split the body into chunks that start right after a line break. The serial
+    // path only needs more than one chunk to report progress in between.
+    const long numChunks = parallel ? 4 * (long) pool->size() : (onProgress ? 64 : 1);
+    std::vector<const char*> chunkBegin(numChunks + 1);
+    chunkBegin[0] = p;
+    chunkBegin[numChunks] = end;
+    for (long i = 1; i < numChunks; i++) {
+        const char* split = std::max(chunkBegin[i - 1], p + (end - p) * i / numChunks);
+        if (split > p && split < end && split[-1] != '\n') {
+            skipLine(split, end);
+        }
+        chunkBegin[i] = split;
+    }
+
+    if (!parallel) {
+        long record = 0;
+        for (long i = 0; i < numChunks && record < numRecords; i++) {
+            if (onProgress && !onProgress((float) i / numChunks)) {
+                return false;
+            }
+            record = parseRecords(chunkBegin[i], chunkBegin[i + 1], record, numVertices, numFaces,
+                                  vertexData, faceData);
+        }
+        if (record < numRecords) {
+            fail("unexpected end of file");
+        }
+        return true;
+    }
+
+    // Count the records in every chunk, which gives each chunk the number of its first record
+    std::vector<long> firstRecord(numChunks + 1, 0);
+    pool->parallelFor(numChunks, 1, [&](long first, long last) {
+        for (long i = first; i < last; i++) {
+            firstRecord[i + 1] = countRecords(chunkBegin[i], chunkBegin[i + 1]);
+        }
+    });
+    for (long i = 0; i < numChunks; i++) {
+        firstRecord[i + 1] += firstRecord[i];
+    }
+    if (firstRecord[numChunks] < numRecords) {
+        fail("unexpected end of file");
+    }
+
+    // Every chunk writes its own disjoint range of the preallocated matrices
+    std::atomic<long> chunksParsed(0);
+    std::atomic<bool> cancelled(false);
+    pool->parallelFor(numChunks, 1, [&](long first, long last) {
+        for (long i = first; i < last; i++) {
+            if (cancelled) {
+                return;
+            }
+            if (firstRecord[i] < numRecords) {
+                parseRecords(chunkBegin[i], chunkBegin[i + 1], firstRecord[i], numVertices, numFaces,
+                             vertexData, faceData);
+            }
+            if (onProgress && !onProgress((float) (chunksParsed.fetch_add(1) + 1) / numChunks)) {
+                cancelled = true;
+            }
+        }
+    });
+    return !cancelled;
+}
+
+bool OffParser::parseFile(const std::string& filePath, Matrix3Xf& vertices, Matrix3Xu& faces,
+                          const ProgressCallback& onProgress) {
+    MappedFile file(filePath);
+    ThreadPool* pool = file.size() >= PARALLEL_THRESHOLD ? &ThreadPool::shared() : nullptr;
+    try {
+        return parse(file.begin(), file.end(), vertices, faces, pool, onProgress);
+    } catch (const std::runtime_error& e) {
+        throw std::runtime_error(std::string(e.what()) + " in " + filePath);
+    }
+}
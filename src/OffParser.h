@@ -0,0 +1,41 @@
+//
+// Allocation free parser for OFF mesh files.
+//
+
+#ifndef UNTITLED_OFFPARSER_H
+#define UNTITLED_OFFPARSER_H
+
+#include <Eigen/Core>
+#include <functional>
+#include <string>
+#include "ThreadPool.h"
+#include "Utils.h"
+
+class OffParser {
+public:
+    // Files at least this large are parsed on ThreadPool::shared()
+    static const size_t PARALLEL_THRESHOLD = 4 << 20;
+
+    // Receives the fraction of the body parsed so far, returning false cancels the parse.
+    // With a pool it is called from the worker threads.
+    typedef std::function<bool(float)> ProgressCallback;
+
+    // Parses an in-memory OFF document into a 3xV vertex matrix and a 3xF index matrix.
+    // Numbers are scanned in place, so no memory is allocated apart from the two matrices.
+    // After the header every vertex and face must be on a line of its own.
+    //
+    // With a pool the body is split into chunks at line breaks. The records in each chunk are
+    // counted in parallel, which fixes where every chunk writes, and then the chunks are parsed
+    // in parallel by the same per-line code as the serial path, so the result is identical.
+    //
+    // Returns false if onProgress cancelled the parse.
+    static bool parse(const char* begin, const char* end, Eigen::Matrix3Xf& vertices, Matrix3Xu& faces,
+                      ThreadPool* pool = nullptr, const ProgressCallback& onProgress = ProgressCallback());
+
+    // Memory maps the file and parses it, throws std::runtime_error on missing or malformed files
+    static bool parseFile(const std::string& filePath, Eigen::Matrix3Xf& vertices, Matrix3Xu& faces,
+                          const ProgressCallback& onProgress = ProgressCallback());
+};
+
+
+#endif //UNTITLED_OFFPARSER_H
@@ -0,0 +1,53 @@
+//
+// Least significant digit radix sort of entries with 64 bit keys, for the per frame sorts of drawing.
+//
+
+#ifndef UNTITLED_RADIXSORT_H
+#define UNTITLED_RADIXSORT_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Sorts entries by their uint64_t member key, one byte per pass. One pass over the entries counts
+// all bytes, bytes that are the same in every key are skipped, so short keys in wide fields cost
+// no more than their length. Stable, scratch is only reused between calls.
+template <class Entry>
+void radixSort(std::vector<Entry>& entries, std::vector<Entry>& scratch) {
+    if (entries.size() < 2) {
+        return;
+    }
+    size_t counts[8][256] = {};
+    for (const Entry& entry : entries) {
+        for (int digit = 0; digit < 8; digit++) {
+            counts[digit][(entry.key >> (8 * digit)) & 0xff]++;
+        }
+    }
+    scratch.resize(entries.size());
+    for (int digit = 0; digit < 8; digit++) {
+        int shift = 8 * digit;
+        if (counts[digit][(entries[0].key >> shift) & 0xff] == entries.size()) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t& count : counts[digit]) {
+            size_t bucket = count;
+            count = offset;
+            offset += bucket;
+        }
+        for (const Entry& entry : entries) {
+            scratch[counts[digit][(entry.key >> shift) & 0xff]++] = entry;
+        }
+        entries.swap(scratch);
+    }
+}
+
+// Unsigned integer in the same order as value, for a float in a sort key
+inline uint32_t orderedFloatBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+
+#endif //UNTITLED_RADIXSORT_H
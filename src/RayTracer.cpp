@@ -0,0 +1,212 @@
+//
+// Renders a World on the CPU by casting one ray per pixel, for previews without a GPU.
+//
+
+#include "RayTracer.h"
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+using namespace Eigen;
+using namespace std;
+
+// Same as the uniforms and clear color of the editor
+const Vector3f RayTracer::LIGHT_POSITION(-5.0f, 0.0f, 10.0f);
+const Vector3f RayTracer::BACKGROUND_COLOR(0.5f, 0.5f, 0.5f);
+
+namespace {
+
+const float AMBIENT_STRENGTH = 0.01f;
+const float BAKED_AMBIENT_STRENGTH = 0.25f;
+const float SPECULAR_STRENGTH = 0.5f;
+const float SHININESS = 32.0f;
+
+}
+
+RayTracer::RayTracer(int width, int height) : width(width), height(height) {
+    if (width <= 0 || height <= 0) {
+        throw std::runtime_error("Invalid image size: " + to_string(width) + "x" + to_string(height));
+    }
+    pixels.resize(3, (long) width * height);
+    pixels.colwise() = BACKGROUND_COLOR;
+}
+
+void RayTracer::primaryRay(const View& view, float x, float y, Vector3f& origin, Vector3f& direction) const {
+    // From the near to the far plane through the point in normalized device coordinates, which
+    // covers orthographic and perspective cameras alike
+    float xNdc = x / width * 2 - 1;
+    float yNdc = 1 - y / height * 2;
+    Vector4f nearPoint = view.inverseClip * Vector4f(xNdc, yNdc, -1, 1);
+    Vector4f farPoint = view.inverseClip * Vector4f(xNdc, yNdc, 1, 1);
+    origin = nearPoint.head<3>() / nearPoint(3);
+    direction = (farPoint.head<3>() / farPoint(3) - origin).normalized();
+}
+
+Vector3f RayTracer::trace(World& world, const View& view, const Vector3f& origin, const Vector3f& direction,
+                          long& numRays) const {
+    const MeshList& meshes = world.getMeshes();
+    Vector3f rayOrigin = origin;
+    float tOffset = 0;
+    for (int layer = 0; layer < MAX_WIREFRAME_LAYERS; layer++) {
+        numRays++;
+        RayHit hit;
+        int meshIndex = world.pick(rayOrigin, direction, hit);
+        if (meshIndex == -1) {
+            break;
+        }
+        const Mesh& mesh = meshes[meshIndex];
+        const Matrix3Xf& vertices = mesh.getVertices();
+        const Matrix3Xu& faces = mesh.getFaces();
+        const Matrix4f& model = mesh.getModel();
+        float t = tOffset + hit.t;
+        Vector3f position = rayOrigin + hit.t * direction;
+
+        Vector3f corners[3];
+        for (int corner = 0; corner < 3; corner++) {
+            corners[corner] = (model * vertices.col(faces(corner, hit.face)).homogeneous()).head<3>();
+        }
+        Vector3f faceNormal = (corners[1] - corners[0]).cross(corners[2] - corners[0]);
+
+        // Edges are one pixel wide, the distance to the edge across from a corner is its
+        // barycentric weight times the height of the triangle over that edge
+        RenderType renderType = mesh.getRenderType();
+        bool onEdge = false;
+        if (renderType != PHONG_SHADE) {
+            float weights[3] = {1 - hit.u - hit.v, hit.u, hit.v};
+            float halfLineWidth = (view.pixelSize + t * view.pixelSpread) / 2;
+            float doubleArea = faceNormal.norm();
+            for (int corner = 0; corner < 3; corner++) {
+                float edgeLength = (corners[(corner + 2) % 3] - corners[(corner + 1) % 3]).norm();
+                if (weights[corner] * doubleArea <= halfLineWidth * edgeLength) {
+                    onEdge = true;
+                }
+            }
+        }
+        if (renderType == WIREFRAME && !onEdge) {
+            // Step past the inside of the triangle and look for what is behind it
+            float step = hit.t + 1e-4f * max(1.0f, hit.t);
+            rayOrigin += step * direction;
+            tOffset += step;
+            continue;
+        }
+        if (renderType == FLAT_SHADE && onEdge) {
+            return Vector3f::Zero();
+        }
+
+        Vector3f normal;
+        if (renderType == PHONG_SHADE) {
+            const Matrix3Xf& vertexNormals = mesh.getVertexNormals();
+            Vector3f objectNormal = (1 - hit.u - hit.v) * vertexNormals.col(faces(0, hit.face))
+                    + hit.u * vertexNormals.col(faces(1, hit.face)) + hit.v * vertexNormals.col(faces(2, hit.face));
+            normal = (mesh.getInverseModel().topLeftCorner<3, 3>().transpose() * objectNormal).normalized();
+        } else {
+            // The shader takes the face normal from screen space derivatives, which face the viewer
+            normal = faceNormal.normalized();
+            if (normal.dot(direction) > 0) {
+                normal = -normal;
+            }
+        }
+
+        Vector3f lightDirection = (LIGHT_POSITION - position).normalized();
+        float diffuse = max(normal.dot(lightDirection), 0.0f);
+        float ambient = AMBIENT_STRENGTH;
+        shared_ptr<const RowVectorXf> occlusion = mesh.getGeometry()->getAmbientOcclusion();
+        if (occlusion) {
+            ambient = BAKED_AMBIENT_STRENGTH * ((1 - hit.u - hit.v) * (*occlusion)(faces(0, hit.face))
+                    + hit.u * (*occlusion)(faces(1, hit.face)) + hit.v * (*occlusion)(faces(2, hit.face)));
+        }
+        float light = ambient + diffuse;
+        if (renderType == PHONG_SHADE) {
+            Vector3f viewDirection = (view.viewPosition - position).normalized();
+            Vector3f reflectDirection = 2 * normal.dot(lightDirection) * normal - lightDirection;
+            light += SPECULAR_STRENGTH * pow(max(viewDirection.dot(reflectDirection), 0.0f), SHININESS);
+        }
+        return (light * mesh.getColor()).cwiseMin(1.0f);
+    }
+    return BACKGROUND_COLOR;
+}
+
+void RayTracer::render(World& world, const Camera& camera, ThreadPool* pool) {
+    auto start = chrono::steady_clock::now();
+    world.updatePickingHierarchy();
+
+    View view;
+    view.inverseClip = (camera.getProjection() * camera.getView()).inverse();
+    view.viewPosition = camera.getCameraPosition();
+    Vector3f origin0, direction0, origin1, direction1;
+    primaryRay(view, width / 2.0f, height / 2.0f, origin0, direction0);
+    primaryRay(view, width / 2.0f + 1, height / 2.0f, origin1, direction1);
+    view.pixelSize = (origin1 - origin0).norm();
+    view.pixelSpread = (direction1 - direction0).norm();
+
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    atomic<long> totalRays(0);
+    ThreadPool::parallelFor(pool, (long) tilesX * tilesY, 1, [&](long begin, long end) {
+        long tileRays = 0;
+        for (long tile = begin; tile < end; tile++) {
+            int x0 = (int) (tile % tilesX) * TILE_SIZE;
+            int y0 = (int) (tile / tilesX) * TILE_SIZE;
+            for (int y = y0; y < min(y0 + TILE_SIZE, height); y++) {
+                for (int x = x0; x < min(x0 + TILE_SIZE, width); x++) {
+                    Vector3f origin, direction;
+                    primaryRay(view, x + 0.5f, y + 0.5f, origin, direction);
+                    pixels.col((long) y * width + x) = trace(world, view, origin, direction, tileRays);
+                }
+            }
+        }
+        totalRays += tileRays;
+    });
+
+    numRays = totalRays;
+    seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int RayTracer::getWidth() const {
+    return width;
+}
+
+int RayTracer::getHeight() const {
+    return height;
+}
+
+const Matrix3Xf& RayTracer::getPixels() const {
+    return pixels;
+}
+
+void RayTracer::writePpm(const string& filePath) const {
+    vector<unsigned char> bytes(pixels.size());
+    for (long i = 0; i < pixels.size(); i++) {
+        bytes[i] = (unsigned char) (min(max(pixels(i), 0.0f), 1.0f) * 255 + 0.5f);
+    }
+    string header = "P6\n" + to_string(width) + " " + to_string(height) + "\n255\n";
+
+    FILE* file = fopen(filePath.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Error opening image file: " + filePath);
+    }
+    bool written = fwrite(header.data(), 1, header.size(), file) == header.size()
+            && fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        throw std::runtime_error("Error writing image file: " + filePath);
+    }
+}
+
+long RayTracer::getNumRays() const {
+    return numRays;
+}
+
+double RayTracer::getSeconds() const {
+    return seconds;
+}
+
+double RayTracer::getRaysPerSecond() const {
+    return seconds > 0 ? numRays / seconds : 0;
+}
@@ -0,0 +1,68 @@
+//
+// Renders a World on the CPU by casting one ray per pixel, for previews without a GPU.
+//
+
+#ifndef UNTITLED_RAYTRACER_H
+#define UNTITLED_RAYTRACER_H
+
+#include <Eigen/Core>
+#include <string>
+#include "Camera.h"
+#include "ThreadPool.h"
+#include "World.h"
+
+// Shades like the editor's shader: flat and Phong lighting from the same point light and baked
+// ambient occlusion where there is some, wireframe meshes as one pixel wide edges and flat shaded
+// meshes with black edges. The image is split into square tiles that the pool renders in any
+// order, every ray goes through the picking hierarchy of the world. Pixels do not depend on the
+// pool, so any thread count gives the same image.
+class RayTracer {
+public:
+    static const int TILE_SIZE = 16;
+    // Rays that pass through the inside of wireframe triangles are continued at most this often
+    static const int MAX_WIREFRAME_LAYERS = 16;
+    static const Eigen::Vector3f LIGHT_POSITION;
+    static const Eigen::Vector3f BACKGROUND_COLOR;
+
+private:
+    int width;
+    int height;
+    // One color per pixel, row by row from the top of the image
+    Eigen::Matrix3Xf pixels;
+    long numRays = 0;
+    double seconds = 0;
+
+    // World space size of a pixel at distance t along a ray is pixelSize + t * pixelSpread
+    struct View {
+        Eigen::Matrix4f inverseClip;
+        Eigen::Vector3f viewPosition;
+        float pixelSize;
+        float pixelSpread;
+    };
+
+    void primaryRay(const View& view, float x, float y, Eigen::Vector3f& origin, Eigen::Vector3f& direction) const;
+    Eigen::Vector3f trace(World& world, const View& view, const Eigen::Vector3f& origin,
+                          const Eigen::Vector3f& direction, long& numRays) const;
+
+public:
+    RayTracer(int width, int height);
+
+    // Renders what camera sees of world. Builds the picking hierarchy of the world first, which
+    // must not change while this runs. Runs on the calling thread when pool is null.
+    void render(World& world, const Camera& camera, ThreadPool* pool = nullptr);
+
+    int getWidth() const;
+    int getHeight() const;
+    const Eigen::Matrix3Xf& getPixels() const;
+
+    // Binary PPM, throws std::runtime_error if the file cannot be written
+    void writePpm(const std::string& filePath) const;
+
+    // Of the last render, counting every ray cast into the world
+    long getNumRays() const;
+    double getSeconds() const;
+    double getRaysPerSecond() const;
+};
+
+
+#endif //UNTITLED_RAYTRACER_H
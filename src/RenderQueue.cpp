@@ -0,0 +1,115 @@
+//
+// Draws of a frame sorted by their state, so that consecutive draws only change what differs.
+//
+
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <iostream>
+#include "RadixSort.h"
+
+using namespace std;
+
+namespace {
+
+const unsigned PROGRAM_VARIANTS_SHIFT = 61;
+
+}
+
+RenderQueue::RenderQueue(unsigned programVariants) : programVariants(programVariants) {
+}
+
+uint64_t RenderQueue::makeKey(bool linePass, unsigned variant, RenderType renderType, unsigned geometryIndex,
+                              float depth) const {
+    // Filled render types first, so the draws of a geometry flip the polygon mode at most twice
+    static const unsigned renderTypeOrder[] = {2, 1, 0};
+    const unsigned geometryMask = (1u << NUM_GEOMETRY_BITS) - 1;
+    const unsigned variantMask = (1u << NUM_VARIANT_BITS) - 1;
+    return (uint64_t) (variant & programVariants & variantMask) << PROGRAM_VARIANTS_SHIFT
+            | (uint64_t) min(geometryIndex, geometryMask) << 38
+            | (uint64_t) renderTypeOrder[renderType] << 36
+            | (uint64_t) orderedFloatBits(depth) << 4
+            | (uint64_t) linePass << 3
+            | (variant & variantMask);
+}
+
+void RenderQueue::clear() {
+    draws.clear();
+}
+
+void RenderQueue::push(const Draw& draw) {
+    draws.push_back(draw);
+}
+
+void RenderQueue::sort() {
+    radixSort(draws, scratch);
+}
+
+void RenderQueue::submit(const StreamBuffer& stream, GLuint uniformsBinding, size_t uniformsSize,
+                         const function<void(unsigned)>& bindProgram,
+                         const function<const ElementBufferObject&(int)>& bindBatch) {
+    auto start = chrono::steady_clock::now();
+    frameStateChanges = 0;
+    unsigned program = UINT_MAX;
+    int batchIndex = -1;
+    GLenum polygonMode = GL_NONE;
+    GLintptr uniformsOffset = -1;
+    const ElementBufferObject* elements = nullptr;
+    for (const Draw& draw : draws) {
+        unsigned drawProgram = (unsigned) (draw.key >> PROGRAM_VARIANTS_SHIFT);
+        if (drawProgram != program) {
+            bindProgram(drawProgram);
+            program = drawProgram;
+            frameStateChanges++;
+        }
+        if (draw.polygonMode != polygonMode) {
+            glPolygonMode(GL_FRONT_AND_BACK, draw.polygonMode);
+            polygonMode = draw.polygonMode;
+            frameStateChanges++;
+        }
+        if (draw.uniformsOffset != uniformsOffset) {
+            stream.bindUniformBlock(uniformsBinding, draw.uniformsOffset, uniformsSize);
+            uniformsOffset = draw.uniformsOffset;
+            frameStateChanges++;
+        }
+        if (draw.batchIndex != batchIndex) {
+            elements = &bindBatch(draw.batchIndex);
+            batchIndex = draw.batchIndex;
+            frameStateChanges++;
+        }
+        glDrawElementsInstanced(GL_TRIANGLES, elements->count, elements->type, 0, draw.numInstances);
+    }
+    frameDraws = (long) draws.size();
+    frameSubmitMilliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    numFrames++;
+    totalDraws += frameDraws;
+    totalStateChanges += frameStateChanges;
+    totalSubmitMilliseconds += frameSubmitMilliseconds;
+}
+
+const vector<RenderQueue::Draw>& RenderQueue::getDraws() const {
+    return draws;
+}
+
+long RenderQueue::getFrameDraws() const {
+    return frameDraws;
+}
+
+long RenderQueue::getFrameStateChanges() const {
+    return frameStateChanges;
+}
+
+double RenderQueue::getFrameSubmitMilliseconds() const {
+    return frameSubmitMilliseconds;
+}
+
+void RenderQueue::printStatistics() const {
+    if (numFrames == 0) {
+        return;
+    }
+    cout << "Render queue: " << numFrames << " frames, per frame " << (double) totalDraws / numFrames << " draws, "
+         << (double) totalStateChanges / numFrames << " state changes, "
+         << totalSubmitMilliseconds / numFrames << " ms submitting" << endl;
+}
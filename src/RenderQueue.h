@@ -0,0 +1,79 @@
+//
+// Draws of a frame sorted by their state, so that consecutive draws only change what differs.
+//
+
+#ifndef UNTITLED_RENDERQUEUE_H
+#define UNTITLED_RENDERQUEUE_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "Helpers.h"
+#include "StreamBuffer.h"
+#include "Utils.h"
+
+// Every draw carries a 64 bit key of, from the most significant bits down, its program variants,
+// geometry, render type, depth, pass (filled before lines) and shader variant. Program variants
+// are the variant flags that pick another program rather than a uniform, so a frame switches
+// programs at most once per program. Binding a batch sets the vertex array and all instance
+// attributes, so it is the most expensive state after the program: the filled and line draws of a
+// batch end up next to each other, and batches of a geometry go front to back. Submitting then sets
+// the program, polygon mode, draw uniform block and batch only when they change.
+class RenderQueue {
+public:
+    // Variants are the flags of the draw uniform block
+    static const unsigned NUM_VARIANT_BITS = 3;
+    static const unsigned NUM_GEOMETRY_BITS = 23;
+
+    struct Draw {
+        uint64_t key;
+        int batchIndex;
+        int numInstances;
+        GLenum polygonMode;
+        // Of the draw uniform block in the stream buffer
+        GLintptr uniformsOffset;
+    };
+
+private:
+    unsigned programVariants;
+    std::vector<Draw> draws;
+    std::vector<Draw> scratch;
+
+    long frameDraws = 0;
+    long frameStateChanges = 0;
+    double frameSubmitMilliseconds = 0;
+    long numFrames = 0;
+    long totalDraws = 0;
+    long totalStateChanges = 0;
+    double totalSubmitMilliseconds = 0;
+
+public:
+    // Draws whose variants differ in programVariants use different programs
+    explicit RenderQueue(unsigned programVariants = 0);
+
+    // Geometries past the width of their field share keys, which only costs state changes. depth
+    // is the view space depth of the nearest instance.
+    uint64_t makeKey(bool linePass, unsigned variant, RenderType renderType, unsigned geometryIndex, float depth) const;
+
+    void clear();
+    void push(const Draw& draw);
+    // Radix sort of the keys
+    void sort();
+
+    // Issues the draws in order. bindProgram binds the program of the program variants of a draw
+    // and bindBatch binds the vertex array and instances of a batch and returns its elements. Each
+    // is called whenever its state differs from the draw before.
+    void submit(const StreamBuffer& stream, GLuint uniformsBinding, size_t uniformsSize,
+                const std::function<void(unsigned)>& bindProgram,
+                const std::function<const ElementBufferObject&(int)>& bindBatch);
+
+    const std::vector<Draw>& getDraws() const;
+    // Of the last submit, counting changes of program, polygon mode, draw uniform block and batch
+    long getFrameDraws() const;
+    long getFrameStateChanges() const;
+    double getFrameSubmitMilliseconds() const;
+    void printStatistics() const;
+};
+
+
+#endif //UNTITLED_RENDERQUEUE_H
@@ -0,0 +1,222 @@
+//
+// Part of the view volume behind a rectangle or lasso drawn on the screen, for region selection.
+//
+
+#include "SelectionFrustum.h"
+
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <limits>
+
+using namespace Eigen;
+using namespace std;
+
+namespace {
+
+float cross(const Vector2f& a, const Vector2f& b) {
+    return a(0) * b(1) - a(1) * b(0);
+}
+
+bool segmentsCross(const Vector2f& a, const Vector2f& b, const Vector2f& c, const Vector2f& d) {
+    float abc = cross(b - a, c - a), abd = cross(b - a, d - a);
+    float cda = cross(d - c, a - c), cdb = cross(d - c, b - c);
+    return ((abc > 0) != (abd > 0)) && ((cda > 0) != (cdb > 0));
+}
+
+// Liang-Barsky clipping of the segment against the filled rectangle
+bool segmentIntersectsRectangle(const Vector2f& a, const Vector2f& b, const Vector2f& rectangleMin,
+                                const Vector2f& rectangleMax) {
+    float tEnter = 0, tExit = 1;
+    Vector2f delta = b - a;
+    for (int axis = 0; axis < 2; axis++) {
+        if (delta(axis) == 0) {
+            if (a(axis) < rectangleMin(axis) || a(axis) > rectangleMax(axis)) return false;
+            continue;
+        }
+        float t0 = (rectangleMin(axis) - a(axis)) / delta(axis);
+        float t1 = (rectangleMax(axis) - a(axis)) / delta(axis);
+        if (t0 > t1) swap(t0, t1);
+        tEnter = max(tEnter, t0);
+        tExit = min(tExit, t1);
+    }
+    return tEnter <= tExit;
+}
+
+bool isInsideConvexPolygon(const Vector2f& point, const Vector2f* polygon, int size) {
+    bool anyPositive = false, anyNegative = false;
+    for (int i = 0, j = size - 1; i < size; j = i++) {
+        float side = cross(polygon[i] - polygon[j], point - polygon[j]);
+        anyPositive |= side > 0;
+        anyNegative |= side < 0;
+    }
+    // A polygon without area contains no point, its edges are tested on their own
+    return anyPositive != anyNegative;
+}
+
+// A triangle clipped by the six planes has at most one corner more per plane
+const int MAX_CLIPPED_CORNERS = 9;
+
+// Sutherland-Hodgman, keeps the part of the convex polygon with plane.dot(p.homogeneous()) >= 0
+int clipPolygon(const Vector3f* polygon, int size, const Vector4f& plane, Vector3f* clipped) {
+    int clippedSize = 0;
+    for (int i = 0, j = size - 1; i < size; j = i++) {
+        float previous = plane.dot(polygon[j].homogeneous()), current = plane.dot(polygon[i].homogeneous());
+        if ((previous >= 0) != (current >= 0)) {
+            clipped[clippedSize++] = polygon[j] + (polygon[i] - polygon[j]) * (previous / (previous - current));
+        }
+        if (current >= 0) {
+            clipped[clippedSize++] = polygon[i];
+        }
+    }
+    return clippedSize;
+}
+
+}
+
+SelectionFrustum::SelectionFrustum(const Matrix4f& clip, const Vector2f& corner0, const Vector2f& corner1) {
+    this->clip = clip;
+    lassoMin = corner0.cwiseMin(corner1);
+    lassoMax = corner0.cwiseMax(corner1);
+    // A point is on screen between xMin and xMax where xMin * w <= x <= xMax * w in clip space
+    RowVector4f x = clip.row(0), y = clip.row(1), z = clip.row(2), w = clip.row(3);
+    planes.col(0) = (x - lassoMin(0) * w).transpose();
+    planes.col(1) = (lassoMax(0) * w - x).transpose();
+    planes.col(2) = (y - lassoMin(1) * w).transpose();
+    planes.col(3) = (lassoMax(1) * w - y).transpose();
+    planes.col(4) = (w + z).transpose();
+    planes.col(5) = (w - z).transpose();
+}
+
+SelectionFrustum SelectionFrustum::rectangle(const Matrix4f& clip, const Vector2f& corner0, const Vector2f& corner1) {
+    return SelectionFrustum(clip, corner0, corner1);
+}
+
+SelectionFrustum SelectionFrustum::lasso(const Matrix4f& clip, const vector<Vector2f>& outline) {
+    Vector2f outlineMin = Vector2f::Zero(), outlineMax = Vector2f::Zero();
+    if (!outline.empty()) {
+        outlineMin = outlineMax = outline[0];
+    }
+    for (const Vector2f& point : outline) {
+        outlineMin = outlineMin.cwiseMin(point);
+        outlineMax = outlineMax.cwiseMax(point);
+    }
+    SelectionFrustum frustum(clip, outlineMin, outlineMax);
+    frustum.lassoOutline = outline;
+    return frustum;
+}
+
+SelectionFrustum SelectionFrustum::transformed(const Matrix4f& model) const {
+    SelectionFrustum result(*this);
+    result.planes = model.transpose() * planes;
+    result.clip = clip * model;
+    return result;
+}
+
+bool SelectionFrustum::isInsideLasso(const Vector2f& point) const {
+    bool inside = false;
+    for (size_t i = 0, j = lassoOutline.size() - 1; i < lassoOutline.size(); j = i++) {
+        const Vector2f& a = lassoOutline[i];
+        const Vector2f& b = lassoOutline[j];
+        if ((a(1) > point(1)) != (b(1) > point(1))
+                && point(0) < a(0) + (b(0) - a(0)) * (point(1) - a(1)) / (b(1) - a(1))) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+bool SelectionFrustum::lassoCrossesSegment(const Vector2f& a, const Vector2f& b) const {
+    for (size_t i = 0, j = lassoOutline.size() - 1; i < lassoOutline.size(); j = i++) {
+        if (segmentsCross(a, b, lassoOutline[j], lassoOutline[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Bvh::Overlap SelectionFrustum::classifyRectangleAgainstLasso(const Vector2f& rectangleMin,
+                                                             const Vector2f& rectangleMax) const {
+    if ((rectangleMax.array() < lassoMin.array()).any() || (rectangleMin.array() > lassoMax.array()).any()) {
+        return Bvh::DISJOINT;
+    }
+    for (size_t i = 0, j = lassoOutline.size() - 1; i < lassoOutline.size(); j = i++) {
+        if (segmentIntersectsRectangle(lassoOutline[j], lassoOutline[i], rectangleMin, rectangleMax)) {
+            return Bvh::OVERLAPPING;
+        }
+    }
+    // No part of the outline is on the rectangle, so it is either all inside or all outside
+    return isInsideLasso((rectangleMin + rectangleMax) / 2) ? Bvh::CONTAINED : Bvh::DISJOINT;
+}
+
+Bvh::Overlap SelectionFrustum::classifyBounds(const Vector3f& boundsMin, const Vector3f& boundsMax) const {
+    Bvh::Overlap overlap = Bvh::CONTAINED;
+    for (int plane = 0; plane < planes.cols(); plane++) {
+        Vector3f insideCorner, outsideCorner;
+        for (int axis = 0; axis < 3; axis++) {
+            bool positive = planes(axis, plane) >= 0;
+            insideCorner(axis) = positive ? boundsMax(axis) : boundsMin(axis);
+            outsideCorner(axis) = positive ? boundsMin(axis) : boundsMax(axis);
+        }
+        if (planes.col(plane).dot(insideCorner.homogeneous()) < 0) {
+            return Bvh::DISJOINT;
+        }
+        if (planes.col(plane).dot(outsideCorner.homogeneous()) < 0) {
+            overlap = Bvh::OVERLAPPING;
+        }
+    }
+    if (lassoOutline.empty()) {
+        return overlap;
+    }
+
+    // The rectangle around the projected corners contains the projected box
+    Vector2f rectangleMin = Vector2f::Constant(numeric_limits<float>::infinity());
+    Vector2f rectangleMax = -rectangleMin;
+    for (int corner = 0; corner < 8; corner++) {
+        Vector3f point((corner & 1) ? boundsMax(0) : boundsMin(0), (corner & 2) ? boundsMax(1) : boundsMin(1),
+                       (corner & 4) ? boundsMax(2) : boundsMin(2));
+        Vector4f projected = clip * point.homogeneous();
+        if (projected(3) <= 0) {
+            // Behind the eye, the box has no rectangle on screen
+            return Bvh::OVERLAPPING;
+        }
+        Vector2f screen = projected.head<2>() / projected(3);
+        rectangleMin = rectangleMin.cwiseMin(screen);
+        rectangleMax = rectangleMax.cwiseMax(screen);
+    }
+    return min(overlap, classifyRectangleAgainstLasso(rectangleMin, rectangleMax));
+}
+
+bool SelectionFrustum::intersectsTriangle(const Vector3f& a, const Vector3f& b, const Vector3f& c) const {
+    // The part of the triangle inside the frustum, which is what the rectangle selects
+    Vector3f polygons[2][MAX_CLIPPED_CORNERS] = {{a, b, c}};
+    int size = 3, current = 0;
+    for (int plane = 0; plane < planes.cols() && size > 0; plane++) {
+        size = clipPolygon(polygons[current], size, planes.col(plane), polygons[1 - current]);
+        current = 1 - current;
+    }
+    if (size == 0) {
+        return false;
+    }
+    if (lassoOutline.empty()) {
+        return true;
+    }
+
+    // Between the near and far plane every point is in front of the eye
+    Vector2f screen[MAX_CLIPPED_CORNERS];
+    for (int corner = 0; corner < size; corner++) {
+        Vector4f projected = clip * polygons[current][corner].homogeneous();
+        screen[corner] = projected.head<2>() / projected(3);
+        if (isInsideLasso(screen[corner])) {
+            return true;
+        }
+    }
+    if (isInsideConvexPolygon(lassoOutline[0], screen, size)) {
+        return true;
+    }
+    for (int i = 0, j = size - 1; i < size; j = i++) {
+        if (lassoCrossesSegment(screen[j], screen[i])) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,50 @@
+//
+// Part of the view volume behind a rectangle or lasso drawn on the screen, for region selection.
+//
+
+#ifndef UNTITLED_SELECTIONFRUSTUM_H
+#define UNTITLED_SELECTIONFRUSTUM_H
+
+#include <Eigen/Core>
+#include <vector>
+#include "Bvh.h"
+
+// The frustum of the rectangle is bounded by six planes in the space of the clip matrix, which
+// are moved into the object space of a mesh without inverting its model. A lasso is cut out of
+// the frustum of its bounding rectangle by projecting onto the screen and testing against its
+// outline. Screen positions are in normalized device coordinates.
+class SelectionFrustum {
+private:
+    // Points p with plane.dot(p.homogeneous()) >= 0 for every column are inside
+    Eigen::Matrix<float, 4, 6> planes;
+    Eigen::Matrix4f clip;
+    std::vector<Eigen::Vector2f> lassoOutline;
+    Eigen::Vector2f lassoMin;
+    Eigen::Vector2f lassoMax;
+
+    SelectionFrustum(const Eigen::Matrix4f& clip, const Eigen::Vector2f& corner0, const Eigen::Vector2f& corner1);
+
+    bool isInsideLasso(const Eigen::Vector2f& point) const;
+    bool lassoCrossesSegment(const Eigen::Vector2f& a, const Eigen::Vector2f& b) const;
+    Bvh::Overlap classifyRectangleAgainstLasso(const Eigen::Vector2f& rectangleMin, const Eigen::Vector2f& rectangleMax) const;
+
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // clip is the projection times the view matrix
+    static SelectionFrustum rectangle(const Eigen::Matrix4f& clip, const Eigen::Vector2f& corner0, const Eigen::Vector2f& corner1);
+    // The outline is closed between its last and first point
+    static SelectionFrustum lasso(const Eigen::Matrix4f& clip, const std::vector<Eigen::Vector2f>& outline);
+
+    // The same region in the object space of a mesh with this model matrix
+    SelectionFrustum transformed(const Eigen::Matrix4f& model) const;
+
+    // Conservative, a box may be found OVERLAPPING when it only comes close to the region
+    Bvh::Overlap classifyBounds(const Eigen::Vector3f& boundsMin, const Eigen::Vector3f& boundsMax) const;
+    // Exact, whether any part of the triangle is inside the frustum and, for a lasso, inside the
+    // outline on screen
+    bool intersectsTriangle(const Eigen::Vector3f& a, const Eigen::Vector3f& b, const Eigen::Vector3f& c) const;
+};
+
+
+#endif //UNTITLED_SELECTIONFRUSTUM_H
@@ -0,0 +1,198 @@
+//
+// Ring of GL data that is rewritten every frame, such as vertices of deforming meshes and per draw uniforms.
+//
+
+#include "StreamBuffer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+// Keeps every write aligned for any attribute type
+const size_t ALIGNMENT = 16;
+
+}
+
+void StreamBuffer::init(size_t regionSize, bool allowPersistent) {
+    inMemory = false;
+    persistent = false;
+#ifndef __APPLE__
+    persistent = allowPersistent && (GLEW_ARB_buffer_storage || GLEW_VERSION_4_4);
+#endif
+    allocate(max(regionSize, ALIGNMENT));
+}
+
+void StreamBuffer::initInMemory(size_t regionSize) {
+    inMemory = true;
+    persistent = false;
+    allocate(max(regionSize, ALIGNMENT));
+}
+
+void StreamBuffer::allocate(size_t regionSize) {
+    this->regionSize = (regionSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    GLsizeiptr size = (GLsizeiptr) (this->regionSize * NUM_REGIONS);
+    if (inMemory) {
+        memory.assign((size_t) size, 0);
+        mapped = memory.data();
+        return;
+    }
+    glGenBuffers(1, &id);
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    if (persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+        mapped = (char*) glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+        if (mapped == nullptr) {
+            throw runtime_error("Failed to map the stream buffer");
+        }
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    }
+    check_gl_error();
+}
+
+void StreamBuffer::release() {
+    if (inMemory) {
+        mapped = nullptr;
+        vector<char>().swap(memory);
+        return;
+    }
+    for (GLsync& fence : fences) {
+        if (fence != nullptr) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (id != 0) {
+        if (mapped != nullptr) {
+            glBindBuffer(GL_ARRAY_BUFFER, id);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            mapped = nullptr;
+        }
+        // Draws that still read the buffer keep its storage alive until they are done
+        glDeleteBuffers(1, &id);
+        id = 0;
+    }
+    check_gl_error();
+}
+
+void StreamBuffer::wait(GLsync& fence) {
+    if (fence == nullptr) {
+        return;
+    }
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        numStalls++;
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+}
+
+void StreamBuffer::beginFrame() {
+    region = (region + 1) % NUM_REGIONS;
+    regionUsed = 0;
+    frameBytes = 0;
+    wait(fences[region]);
+}
+
+void StreamBuffer::endFrame() {
+    if (inMemory) {
+        return;
+    }
+    if (fences[region] != nullptr) {
+        glDeleteSync(fences[region]);
+    }
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+size_t StreamBuffer::paddedBytes(size_t bytes, size_t alignment) {
+    return bytes + alignment - 1;
+}
+
+void StreamBuffer::reserve(size_t bytes) {
+    if (regionUsed + bytes > regionSize) {
+        if (regionUsed > 0) {
+            throw runtime_error("Stream buffer reserved after the frame mapped into it");
+        }
+        release();
+        allocate(max(2 * regionSize, regionUsed + bytes));
+        regionUsed = 0;
+    }
+}
+
+void* StreamBuffer::map(size_t bytes, GLintptr& offset, size_t alignment) {
+    size_t start = (region * regionSize + regionUsed + alignment - 1) / alignment * alignment;
+    if (start + bytes > (region + 1) * regionSize) {
+        throw runtime_error("Stream buffer frame overflows what was reserved");
+    }
+    offset = (GLintptr) start;
+    regionUsed = start + bytes - region * regionSize;
+    frameBytes += bytes;
+    totalBytes += bytes;
+    if (mapped != nullptr) {
+        return mapped + offset;
+    }
+
+    // The fence of the region already guarantees that the GPU is done with the range
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    void* pointer = glMapBufferRange(GL_ARRAY_BUFFER, offset, (GLsizeiptr) bytes,
+                                     GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    if (pointer == nullptr) {
+        throw runtime_error("Failed to map the stream buffer");
+    }
+    return pointer;
+}
+
+void StreamBuffer::unmap() {
+    if (mapped == nullptr) {
+        glBindBuffer(GL_ARRAY_BUFFER, id);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        check_gl_error();
+    }
+}
+
+void StreamBuffer::bindVertexAttribArray(GLint attribute, GLint size, GLintptr offset, GLsizei stride) const {
+    if (attribute < 0) {
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, id);
+    glEnableVertexAttribArray(attribute);
+    glVertexAttribPointer(attribute, size, GL_FLOAT, GL_FALSE, stride, (const void*) offset);
+    check_gl_error();
+}
+
+void StreamBuffer::bindUniformBlock(GLuint binding, GLintptr offset, size_t size) const {
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, id, offset, (GLsizeiptr) size);
+}
+
+void StreamBuffer::free() {
+    release();
+    regionSize = 0;
+    regionUsed = 0;
+}
+
+bool StreamBuffer::isPersistent() const {
+    return persistent;
+}
+
+size_t StreamBuffer::getRegionSize() const {
+    return regionSize;
+}
+
+long StreamBuffer::getFrameBytes() const {
+    return frameBytes;
+}
+
+long StreamBuffer::getTotalBytes() const {
+    return totalBytes;
+}
+
+long StreamBuffer::getNumStalls() const {
+    return numStalls;
+}
@@ -0,0 +1,93 @@
+//
+// Ring of GL data that is rewritten every frame, such as vertices of deforming meshes and per draw uniforms.
+//
+
+#ifndef UNTITLED_STREAMBUFFER_H
+#define UNTITLED_STREAMBUFFER_H
+
+#include "Helpers.h"
+
+#include <cstddef>
+#include <vector>
+
+// One array buffer split into a region per frame in flight. Every frame writes into the next
+// region, after waiting on the fence of the frame that last drew from it, so writes never
+// overwrite data the GPU may still read and the driver never has to copy or reallocate anything.
+// With ARB_buffer_storage the whole buffer stays mapped and map only returns a pointer into it.
+// Without it, every map is an unsynchronized glMapBufferRange of the range, which the fences keep
+// safe in the same way. A frame that needs more than a region holds grows the buffer in reserve,
+// before anything of the frame is bound.
+class StreamBuffer {
+public:
+    static const int NUM_REGIONS = 3;
+
+private:
+    GLuint id = 0;
+    size_t regionSize = 0;
+    bool persistent = false;
+    // Regions in client memory instead of a GL buffer
+    bool inMemory = false;
+    std::vector<char> memory;
+    // Start of the whole buffer while it is mapped persistently or in memory
+    char* mapped = nullptr;
+    GLsync fences[NUM_REGIONS] = {};
+    int region = 0;
+    size_t regionUsed = 0;
+    long frameBytes = 0;
+    long totalBytes = 0;
+    long numStalls = 0;
+
+    void allocate(size_t regionSize);
+    void release();
+    void wait(GLsync& fence);
+
+public:
+    StreamBuffer() = default;
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    // Creates the buffer with room for regionSize bytes per frame. allowPersistent false always
+    // takes the glMapBufferRange path.
+    void init(size_t regionSize, bool allowPersistent = true);
+    // Keeps the regions in client memory, so the CPU side of frames runs without a GL context.
+    // Nothing of it can be bound for drawing.
+    void initInMemory(size_t regionSize);
+
+    // Moves on to the next region, waiting for the GPU to finish the frame that used it before
+    void beginFrame();
+    // Fences the region of this frame, call after its last draw
+    void endFrame();
+    // Bytes to reserve for a map of bytes, including the padding that aligning its start may add
+    static size_t paddedBytes(size_t bytes, size_t alignment = 16);
+
+    // Makes sure that bytes fit into this frame, growing the buffer if they would not. Growing
+    // drops the buffer that offsets of this frame refer to, so the frame reserves everything it
+    // maps, padded, right after beginFrame.
+    void reserve(size_t bytes);
+
+    // Returns where to write bytes of this frame, and their offset in the buffer for
+    // glVertexAttribPointer, a multiple of alignment. Has to be followed by unmap before drawing.
+    // Throws if the frame did not reserve enough, the buffer never grows while offsets are bound.
+    void* map(size_t bytes, GLintptr& offset, size_t alignment = 16);
+    void unmap();
+
+    // Reads the attribute from offset, floats with size components per vertex stride bytes apart,
+    // 0 when they are packed
+    void bindVertexAttribArray(GLint attribute, GLint size, GLintptr offset, GLsizei stride = 0) const;
+    // Backs the uniform block at binding with size bytes from offset
+    void bindUniformBlock(GLuint binding, GLintptr offset, size_t size) const;
+
+    // Release the buffer and the fences
+    void free();
+
+    bool isPersistent() const;
+    size_t getRegionSize() const;
+    // Bytes mapped since beginFrame, and since init
+    long getFrameBytes() const;
+    long getTotalBytes() const;
+    // Frames that had to wait for the GPU before they could write
+    long getNumStalls() const;
+};
+
+
+#endif //UNTITLED_STREAMBUFFER_H
@@ -0,0 +1,139 @@
+//
+// Fixed size pool of worker threads shared by the loaders and the geometry kernels.
+//
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+namespace {
+
+struct ParallelForState {
+    std::function<void(long, long)> body;
+    long count;
+    long grainSize;
+    long numChunks;
+    std::atomic<long> nextChunk;
+    std::atomic<long> chunksDone;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+
+    // Claims chunks until none are left. Helpers that only start after the caller
+    // has returned find the counter exhausted and exit without touching body.
+    void run() {
+        long chunk;
+        while ((chunk = nextChunk.fetch_add(1)) < numChunks) {
+            long begin = chunk * grainSize;
+            long end = std::min(count, begin + grainSize);
+            try {
+                body(begin, end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+            }
+            if (chunksDone.fetch_add(1) + 1 == numChunks) {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+}
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < threadCount; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned ThreadPool::size() const {
+    return (unsigned) workers.size();
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(long count, long grainSize, const std::function<void(long, long)>& body) {
+    if (count <= 0) {
+        return;
+    }
+    grainSize = std::max(1L, grainSize);
+    long numChunks = (count + grainSize - 1) / grainSize;
+    if (numChunks == 1 || workers.size() <= 1) {
+        body(0, count);
+        return;
+    }
+
+    auto state = std::make_shared<ParallelForState>();
+    state->body = body;
+    state->count = count;
+    state->grainSize = grainSize;
+    state->numChunks = numChunks;
+    state->nextChunk = 0;
+    state->chunksDone = 0;
+
+    long helpers = std::min((long) workers.size(), numChunks) - 1;
+    for (long i = 0; i < helpers; i++) {
+        enqueue([state]() { state->run(); });
+    }
+    state->run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state]() { return state->chunksDone.load() == state->numChunks; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+void ThreadPool::parallelFor(ThreadPool* pool, long count, long grainSize,
+                             const std::function<void(long, long)>& body) {
+    if (pool != nullptr) {
+        pool->parallelFor(count, grainSize, body);
+    } else if (count > 0) {
+        body(0, count);
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
@@ -0,0 +1,60 @@
+//
+// Fixed size pool of worker threads shared by the loaders and the geometry kernels.
+//
+
+#ifndef UNTITLED_THREADPOOL_H
+#define UNTITLED_THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    bool stopping = false;
+
+    void enqueue(std::function<void()> task);
+    void workerLoop();
+
+public:
+    // threadCount 0 uses one thread per hardware core
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const;
+
+    // Queues a task, the future rethrows anything the task threw
+    template <class Task>
+    std::future<void> submit(Task task) {
+        auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+        std::future<void> result = packaged->get_future();
+        enqueue([packaged]() { (*packaged)(); });
+        return result;
+    }
+
+    // Calls body(begin, end) on consecutive ranges of at most grainSize items covering [0, count)
+    // and blocks until all of them are done. The calling thread works on ranges too, so this is
+    // safe to call from inside a pool task. The first exception thrown by body is rethrown here.
+    void parallelFor(long count, long grainSize, const std::function<void(long, long)>& body);
+
+    // Same as above on pool, or body(0, count) on the calling thread when pool is null
+    static void parallelFor(ThreadPool* pool, long count, long grainSize, const std::function<void(long, long)>& body);
+
+    // Process wide pool sized to the machine
+    static ThreadPool& shared();
+};
+
+
+#endif //UNTITLED_THREADPOOL_H
@@ -0,0 +1,440 @@
+//
+// Triangles of the leaves of a Bvh in structure of arrays blocks, intersected with rays several
+// triangles at a time.
+//
+
+#include "TriangleBlocks.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using namespace Eigen;
+using namespace std;
+
+// The SIMD versions are written once with the vector extensions of GCC and Clang and compiled
+// for every instruction set by the target attribute of the functions that inline them
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRIANGLE_BLOCKS_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Same tolerances as Utils::rayTriangleIntersect
+const float EPSILON = 0.00001;
+const float MAX_T = 1 / EPSILON;
+// Smallest |a| of forEachHit, which only rejects rays exactly parallel to the face
+const float MIN_PARALLEL = numeric_limits<float>::denorm_min();
+
+// The hit with the lowest lane wins ties, like a loop over the faces in order
+inline void updateHit(RayHit& hit, uint32_t face, float t, float u, float v) {
+    if (t < hit.t) {
+        hit.t = t;
+        hit.face = face;
+        hit.u = u;
+        hit.v = v;
+    }
+}
+
+void intersectBlocksScalar(const TriangleBlocks::Block* begin, const TriangleBlocks::Block* end,
+                           const Matrix3Xu& faces, const Matrix3Xf& vertices, const Vector3f* origins,
+                           const Vector3f* directions, int numRays, RayHit* hits) {
+    for (const TriangleBlocks::Block* block = begin; block != end; block++) {
+        for (int lane = 0; lane < TriangleBlocks::BLOCK_SIZE && block->faces[lane] != UINT32_MAX; lane++) {
+            uint32_t face = block->faces[lane];
+            for (int ray = 0; ray < numRays; ray++) {
+                float t, u, v;
+                if (Utils::rayTriangleIntersect(origins[ray], directions[ray], vertices.col(faces(0, face)),
+                        vertices.col(faces(1, face)), vertices.col(faces(2, face)), t, u, v)) {
+                    updateHit(hits[ray], face, t, u, v);
+                }
+            }
+        }
+    }
+}
+
+// Same operations in the same order as the SIMD version, one lane at a time
+int hitLanesScalar(const TriangleBlocks::Block& block, const Vector3f& origin, const Vector3f& d,
+                   float minT, float maxT, float* tLanes) {
+    int bits = 0;
+    for (int lane = 0; lane < TriangleBlocks::BLOCK_SIZE; lane++) {
+        float v0[3], e1[3], e2[3];
+        for (int axis = 0; axis < 3; axis++) {
+            v0[axis] = block.vertex0[axis][lane];
+            e1[axis] = block.edge1[axis][lane];
+            e2[axis] = block.edge2[axis][lane];
+        }
+        float s[3] = {origin(0) - v0[0], origin(1) - v0[1], origin(2) - v0[2]};
+        float h[3] = {d(1) * e2[2] - d(2) * e2[1], d(2) * e2[0] - d(0) * e2[2], d(0) * e2[1] - d(1) * e2[0]};
+        float a = e1[0] * h[0] + e1[1] * h[1] + e1[2] * h[2];
+        if (a > -MIN_PARALLEL && a < MIN_PARALLEL) continue;
+        float f = 1.0f / a;
+        float u = f * (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]);
+        if (u < 0.0f || u > 1.0f) continue;
+        float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+        float v = f * (d(0) * q[0] + d(1) * q[1] + d(2) * q[2]);
+        if (v < 0.0f || u + v > 1.0f) continue;
+        float t = f * (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]);
+        if (t > minT && t < maxT) {
+            tLanes[lane] = t;
+            bits |= 1 << lane;
+        }
+    }
+    return bits;
+}
+
+#ifdef TRIANGLE_BLOCKS_SIMD
+
+typedef float Float4 __attribute__((vector_size(16)));
+typedef float Float8 __attribute__((vector_size(32)));
+typedef float Float16 __attribute__((vector_size(64)));
+typedef int Int4 __attribute__((vector_size(16)));
+typedef int Int8 __attribute__((vector_size(32)));
+typedef int Int16 __attribute__((vector_size(64)));
+
+// One bit per lane of a comparison result
+__attribute__((target("sse2")))
+inline int laneBits(const Int4& mask) {
+    return _mm_movemask_ps((__m128) mask);
+}
+
+__attribute__((target("avx2")))
+inline int laneBits(const Int8& mask) {
+    return _mm256_movemask_ps((__m256) mask);
+}
+
+__attribute__((target("avx512f")))
+inline int laneBits(const Int16& mask) {
+    return _mm512_test_epi32_mask((__m512i) mask, (__m512i) mask);
+}
+
+// Vectors are passed by reference, so no function depends on how a target passes them
+template <typename FloatV>
+inline void broadcast(FloatV& vector, float value) {
+    for (size_t lane = 0; lane < sizeof(FloatV) / sizeof(float); lane++) {
+        vector[lane] = value;
+    }
+}
+
+// The corners and edges of as many consecutive blocks as the vector holds
+template <typename FloatV>
+inline void loadBlocks(const TriangleBlocks::Block* first, FloatV* v0, FloatV* e1, FloatV* e2) {
+    const int numBlocks = sizeof(FloatV) / sizeof(first->vertex0[0]);
+    for (int axis = 0; axis < 3; axis++) {
+        for (int block = 0; block < numBlocks; block++) {
+            memcpy((char*) &v0[axis] + block * sizeof(first->vertex0[0]), first[block].vertex0[axis], sizeof(first->vertex0[0]));
+            memcpy((char*) &e1[axis] + block * sizeof(first->edge1[0]), first[block].edge1[axis], sizeof(first->edge1[0]));
+            memcpy((char*) &e2[axis] + block * sizeof(first->edge2[0]), first[block].edge2[axis], sizeof(first->edge2[0]));
+        }
+    }
+}
+
+// Lanes whose values pass the same tests as Utils::rayTriangleIntersect with parallel as its epsilon
+template <typename FloatV>
+inline int validLanes(const FloatV& a, const FloatV& u, const FloatV& v, const FloatV& t,
+                      float parallel, float minT, float maxT) {
+    FloatV zero, one, plusParallel, minusParallel, tMin, tMax;
+    broadcast(zero, 0.0f);
+    broadcast(one, 1.0f);
+    broadcast(plusParallel, parallel);
+    broadcast(minusParallel, -parallel);
+    broadcast(tMin, minT);
+    broadcast(tMax, maxT);
+    return laneBits(((a <= minusParallel) | (a >= plusParallel)) & (u >= zero) & (u <= one) & (v >= zero)
+            & (u + v <= one) & (t > tMin) & (t < tMax));
+}
+
+// 16 lane comparisons give mask registers, which GCC only turns into vectors in functions
+// compiled for AVX-512 themselves and not in the template above
+__attribute__((target("avx512f,avx512dq")))
+inline int validLanes(const Float16& a, const Float16& u, const Float16& v, const Float16& t,
+                      float parallel, float minT, float maxT) {
+    Float16 zero, one, plusParallel, minusParallel, tMin, tMax;
+    broadcast(zero, 0.0f);
+    broadcast(one, 1.0f);
+    broadcast(plusParallel, parallel);
+    broadcast(minusParallel, -parallel);
+    broadcast(tMin, minT);
+    broadcast(tMax, maxT);
+    return laneBits(((a <= minusParallel) | (a >= plusParallel)) & (u >= zero) & (u <= one) & (v >= zero)
+            & (u + v <= one) & (t > tMin) & (t < tMax));
+}
+
+// Moller-Trumbore on every lane, the bits of the lanes that pass are returned
+template <typename FloatV>
+inline int hitVector(const FloatV* v0, const FloatV* e1, const FloatV* e2, const Vector3f& origin,
+                     const Vector3f& direction, float parallel, float minT, float maxT, FloatV& t, FloatV& u, FloatV& v) {
+    FloatV one, d[3], s[3];
+    broadcast(one, 1.0f);
+    for (int axis = 0; axis < 3; axis++) {
+        FloatV o;
+        broadcast(o, origin(axis));
+        broadcast(d[axis], direction(axis));
+        s[axis] = o - v0[axis];
+    }
+    FloatV h0 = d[1] * e2[2] - d[2] * e2[1];
+    FloatV h1 = d[2] * e2[0] - d[0] * e2[2];
+    FloatV h2 = d[0] * e2[1] - d[1] * e2[0];
+    FloatV a = e1[0] * h0 + e1[1] * h1 + e1[2] * h2;
+    FloatV f = one / a;
+    u = f * (s[0] * h0 + s[1] * h1 + s[2] * h2);
+    FloatV q0 = s[1] * e1[2] - s[2] * e1[1];
+    FloatV q1 = s[2] * e1[0] - s[0] * e1[2];
+    FloatV q2 = s[0] * e1[1] - s[1] * e1[0];
+    v = f * (d[0] * q0 + d[1] * q1 + d[2] * q2);
+    t = f * (e2[0] * q0 + e2[1] * q1 + e2[2] * q2);
+    return validLanes(a, u, v, t, parallel, minT, maxT);
+}
+
+// Every ray against the blocks starting at first, as many as the vector holds
+template <typename FloatV>
+inline void intersectGroup(const TriangleBlocks::Block* first, const Vector3f* origins,
+                           const Vector3f* directions, int numRays, RayHit* hits) {
+    FloatV v0[3], e1[3], e2[3];
+    loadBlocks(first, v0, e1, e2);
+    for (int ray = 0; ray < numRays; ray++) {
+        FloatV t, u, v;
+        int bits = hitVector(v0, e1, e2, origins[ray], directions[ray], EPSILON, EPSILON,
+                             min(MAX_T, hits[ray].t), t, u, v);
+        for (; bits != 0; bits &= bits - 1) {
+            int lane = __builtin_ctz(bits);
+            const TriangleBlocks::Block& block = first[lane / TriangleBlocks::BLOCK_SIZE];
+            updateHit(hits[ray], block.faces[lane % TriangleBlocks::BLOCK_SIZE], t[lane], u[lane], v[lane]);
+        }
+    }
+}
+
+// Groups of blocks as wide as the vector, the rest one block at a time
+template <typename FloatV>
+inline void intersectRange(const TriangleBlocks::Block* begin, const TriangleBlocks::Block* end,
+                           const Vector3f* origins, const Vector3f* directions, int numRays, RayHit* hits) {
+    const long groupBlocks = sizeof(FloatV) / sizeof(Float4);
+    const TriangleBlocks::Block* block = begin;
+    for (; end - block >= groupBlocks; block += groupBlocks) {
+        intersectGroup<FloatV>(block, origins, directions, numRays, hits);
+    }
+    for (; block != end; block++) {
+        intersectGroup<Float4>(block, origins, directions, numRays, hits);
+    }
+}
+
+__attribute__((target("sse2"), flatten))
+void intersectBlocksSse(const TriangleBlocks::Block* begin, const TriangleBlocks::Block* end,
+                        const Vector3f* origins, const Vector3f* directions, int numRays, RayHit* hits) {
+    intersectRange<Float4>(begin, end, origins, directions, numRays, hits);
+}
+
+__attribute__((target("avx2"), flatten))
+void intersectBlocksAvx2(const TriangleBlocks::Block* begin, const TriangleBlocks::Block* end,
+                         const Vector3f* origins, const Vector3f* directions, int numRays, RayHit* hits) {
+    intersectRange<Float8>(begin, end, origins, directions, numRays, hits);
+}
+
+__attribute__((target("avx512f,avx512dq"), flatten))
+void intersectBlocksAvx512(const TriangleBlocks::Block* begin, const TriangleBlocks::Block* end,
+                           const Vector3f* origins, const Vector3f* directions, int numRays, RayHit* hits) {
+    intersectRange<Float16>(begin, end, origins, directions, numRays, hits);
+}
+
+// A single block fills an SSE register, the wider sets would have nothing to add
+__attribute__((target("sse2"), flatten))
+int hitLanesSse(const TriangleBlocks::Block& block, const Vector3f& origin, const Vector3f& direction,
+                float minT, float maxT, float* tLanes) {
+    Float4 v0[3], e1[3], e2[3], t, u, v;
+    loadBlocks(&block, v0, e1, e2);
+    int bits = hitVector(v0, e1, e2, origin, direction, MIN_PARALLEL, minT, maxT, t, u, v);
+    memcpy(tLanes, &t, sizeof(t));
+    return bits;
+}
+
+#endif
+
+TriangleBlocks::Isa detectIsa() {
+    if (TriangleBlocks::isSupported(TriangleBlocks::ISA_AVX512)) return TriangleBlocks::ISA_AVX512;
+    if (TriangleBlocks::isSupported(TriangleBlocks::ISA_AVX2)) return TriangleBlocks::ISA_AVX2;
+    if (TriangleBlocks::isSupported(TriangleBlocks::ISA_SSE)) return TriangleBlocks::ISA_SSE;
+    return TriangleBlocks::ISA_SCALAR;
+}
+
+void checkSupported(TriangleBlocks::Isa isa) {
+    if (!TriangleBlocks::isSupported(isa)) {
+        throw runtime_error(string("Instruction set not supported: ") + TriangleBlocks::getIsaName(isa));
+    }
+}
+
+}
+
+TriangleBlocks::TriangleBlocks(const Bvh& bvh, const Matrix3Xu& faces, const Matrix3Xf& vertices)
+        : bvh(bvh), faces(faces), vertices(vertices) {
+    const vector<Bvh::Node>& nodes = bvh.getNodes();
+    const vector<uint32_t>& faceOrder = bvh.getFaceOrder();
+    firstBlocks.resize(nodes.size() + 1);
+    long numBlocks = 0;
+    for (size_t nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++) {
+        firstBlocks[nodeIndex] = (uint32_t) numBlocks;
+        numBlocks += (nodes[nodeIndex].count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+    firstBlocks[nodes.size()] = (uint32_t) numBlocks;
+
+    blocks.resize(numBlocks);
+    for (size_t nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++) {
+        const Bvh::Node& node = nodes[nodeIndex];
+        for (uint32_t i = 0; i < (firstBlocks[nodeIndex + 1] - firstBlocks[nodeIndex]) * BLOCK_SIZE; i++) {
+            Block& block = blocks[firstBlocks[nodeIndex] + i / BLOCK_SIZE];
+            int lane = (int) (i % BLOCK_SIZE);
+            Vector3f v0 = Vector3f::Zero(), edge1 = Vector3f::Zero(), edge2 = Vector3f::Zero();
+            block.faces[lane] = UINT32_MAX;
+            if (i < node.count) {
+                uint32_t face = faceOrder[node.offset + i];
+                v0 = vertices.col(faces(0, face));
+                edge1 = vertices.col(faces(1, face)) - v0;
+                edge2 = vertices.col(faces(2, face)) - v0;
+                block.faces[lane] = face;
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                block.vertex0[axis][lane] = v0(axis);
+                block.edge1[axis][lane] = edge1(axis);
+                block.edge2[axis][lane] = edge2(axis);
+            }
+        }
+    }
+}
+
+bool TriangleBlocks::isSupported(Isa isa) {
+    switch (isa) {
+        case ISA_SCALAR:
+            return true;
+#ifdef TRIANGLE_BLOCKS_SIMD
+        case ISA_SSE:
+            return __builtin_cpu_supports("sse2");
+        case ISA_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case ISA_AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+#endif
+        default:
+            return false;
+    }
+}
+
+TriangleBlocks::Isa TriangleBlocks::getBestIsa() {
+    static const Isa bestIsa = detectIsa();
+    return bestIsa;
+}
+
+const char* TriangleBlocks::getIsaName(Isa isa) {
+    switch (isa) {
+        case ISA_SSE:
+            return "SSE";
+        case ISA_AVX2:
+            return "AVX2";
+        case ISA_AVX512:
+            return "AVX-512";
+        default:
+            return "scalar";
+    }
+}
+
+long TriangleBlocks::getNumBlocks() const {
+    return (long) blocks.size();
+}
+
+const vector<TriangleBlocks::Block>& TriangleBlocks::getBlocks() const {
+    return blocks;
+}
+
+size_t TriangleBlocks::getMemoryUsage() const {
+    return sizeof(Block) * blocks.size() + sizeof(uint32_t) * firstBlocks.size();
+}
+
+void TriangleBlocks::intersectBlockRange(const Block* begin, const Block* end, const Vector3f* origins,
+                                         const Vector3f* directions, int numRays, RayHit* hits, Isa isa) const {
+    switch (isa) {
+#ifdef TRIANGLE_BLOCKS_SIMD
+        case ISA_SSE:
+            intersectBlocksSse(begin, end, origins, directions, numRays, hits);
+            break;
+        case ISA_AVX2:
+            intersectBlocksAvx2(begin, end, origins, directions, numRays, hits);
+            break;
+        case ISA_AVX512:
+            intersectBlocksAvx512(begin, end, origins, directions, numRays, hits);
+            break;
+#endif
+        default:
+            intersectBlocksScalar(begin, end, faces, vertices, origins, directions, numRays, hits);
+            break;
+    }
+}
+
+int TriangleBlocks::hitLanes(uint32_t block, const Vector3f& origin, const Vector3f& direction,
+                             float minT, float maxT, float* t, Isa isa) const {
+#ifdef TRIANGLE_BLOCKS_SIMD
+    if (isa != ISA_SCALAR) {
+        return hitLanesSse(blocks[block], origin, direction, minT, maxT, t);
+    }
+#endif
+    return hitLanesScalar(blocks[block], origin, direction, minT, maxT, t);
+}
+
+bool TriangleBlocks::intersect(const Vector3f& origin, const Vector3f& direction, RayHit& hit, Isa isa) const {
+    checkSupported(isa);
+    float previousT = hit.t;
+    bvh.traverseLeaves(origin, direction, hit.t, [&](uint32_t nodeIndex) {
+        intersectBlockRange(blocks.data() + firstBlocks[nodeIndex], blocks.data() + firstBlocks[nodeIndex + 1],
+                        &origin, &direction, 1, &hit, isa);
+    });
+    return hit.t < previousT;
+}
+
+void TriangleBlocks::intersect(const Vector3f* origins, const Vector3f* directions, int numRays,
+                               RayHit* hits, Isa isa) const {
+    checkSupported(isa);
+    const vector<Bvh::Node>& nodes = bvh.getNodes();
+    if (nodes.empty()) {
+        return;
+    }
+    for (int first = 0; first < numRays; first += MAX_PACKET_SIZE) {
+        const int packetSize = min(MAX_PACKET_SIZE, numRays - first);
+        Vector3f inverseDirections[MAX_PACKET_SIZE];
+        for (int ray = 0; ray < packetSize; ray++) {
+            inverseDirections[ray] = directions[first + ray].cwiseInverse();
+        }
+
+        // The same walk as Bvh::traverseLeaves, ordered by the direction of the first ray
+        uint32_t stack[Bvh::MAX_DEPTH + 2];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            uint32_t nodeIndex = stack[--stackSize];
+            const Bvh::Node& node = nodes[nodeIndex];
+            bool entered = false;
+            for (int ray = 0; ray < packetSize && !entered; ray++) {
+                entered = Bvh::intersectsBounds(node, origins[first + ray], inverseDirections[ray], hits[first + ray].t);
+            }
+            if (!entered) {
+                continue;
+            }
+            if (node.count > 0) {
+                intersectBlockRange(blocks.data() + firstBlocks[nodeIndex], blocks.data() + firstBlocks[nodeIndex + 1],
+                                origins + first, directions + first, packetSize, hits + first, isa);
+                continue;
+            }
+            if (directions[first](node.axis) < 0) {
+                stack[stackSize++] = nodeIndex + 1;
+                stack[stackSize++] = node.offset;
+            } else {
+                stack[stackSize++] = node.offset;
+                stack[stackSize++] = nodeIndex + 1;
+            }
+        }
+    }
+}
+
+void TriangleBlocks::intersectBlocks(long firstBlock, long lastBlock, const Vector3f* origins,
+                                     const Vector3f* directions, int numRays, RayHit* hits, Isa isa) const {
+    checkSupported(isa);
+    intersectBlockRange(blocks.data() + firstBlock, blocks.data() + lastBlock, origins, directions, numRays, hits, isa);
+}
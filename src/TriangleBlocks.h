@@ -0,0 +1,109 @@
+//
+// Triangles of the leaves of a Bvh in structure of arrays blocks, intersected with rays several
+// triangles at a time.
+//
+
+#ifndef UNTITLED_TRIANGLEBLOCKS_H
+#define UNTITLED_TRIANGLEBLOCKS_H
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+#include "Bvh.h"
+#include "Utils.h"
+
+// Every leaf of the hierarchy keeps its triangles in blocks of BLOCK_SIZE, as their first corner
+// and two edges with one array per coordinate, so an SSE register loads the same coordinate of a
+// whole block. A leaf of up to Bvh::MAX_LEAF_SIZE faces is one block. The test is the same
+// Moller-Trumbore test as Utils::rayTriangleIntersect, on one block per SSE instruction and on
+// 2 (AVX2) or 4 (AVX-512) consecutive blocks where a leaf or a range has that many. The widest
+// instruction set the CPU supports is picked at run time. Other compilers and CPUs, and
+// ISA_SCALAR, call Utils::rayTriangleIntersect on every face instead.
+class TriangleBlocks {
+public:
+    enum Isa {
+        ISA_SCALAR,
+        ISA_SSE,
+        ISA_AVX2,
+        ISA_AVX512
+    };
+
+    static const int BLOCK_SIZE = 4;
+    // Rays traversed together by a packet, longer packets are split
+    static const int MAX_PACKET_SIZE = 64;
+
+    // Unused slots of the last block of a leaf are degenerate and never hit
+    struct Block {
+        float vertex0[3][BLOCK_SIZE];
+        float edge1[3][BLOCK_SIZE];
+        float edge2[3][BLOCK_SIZE];
+        uint32_t faces[BLOCK_SIZE];
+    };
+
+private:
+    const Bvh& bvh;
+    const Matrix3Xu& faces;
+    const Eigen::Matrix3Xf& vertices;
+    std::vector<Block> blocks;
+    // The blocks of node i are firstBlocks[i] up to firstBlocks[i + 1], none for interior nodes
+    std::vector<uint32_t> firstBlocks;
+
+    void intersectBlockRange(const Block* begin, const Block* end, const Eigen::Vector3f* origins,
+                             const Eigen::Vector3f* directions, int numRays, RayHit* hits, Isa isa) const;
+    // Bit i is set if the ray hits lane i of the block with t in (minT, maxT), which is then in t[i]
+    int hitLanes(uint32_t block, const Eigen::Vector3f& origin, const Eigen::Vector3f& direction,
+                 float minT, float maxT, float* t, Isa isa) const;
+
+public:
+    // Blocks for the leaves of bvh, which has to be built over faces. All three have to outlive
+    // the blocks.
+    TriangleBlocks(const Bvh& bvh, const Matrix3Xu& faces, const Eigen::Matrix3Xf& vertices);
+
+    static bool isSupported(Isa isa);
+    // Widest supported instruction set, detected once
+    static Isa getBestIsa();
+    static const char* getIsaName(Isa isa);
+
+    long getNumBlocks() const;
+    const std::vector<Block>& getBlocks() const;
+    size_t getMemoryUsage() const;
+
+    // Closest hit of the ray origin + t * direction through the hierarchy, with the same result as
+    // Utils::rayTriangleIntersect up to rounding. hit is only updated when a closer face is found.
+    bool intersect(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, RayHit& hit,
+                   Isa isa = getBestIsa()) const;
+
+    // Closest hits of a packet of rays through the hierarchy. A node is visited when any ray of the
+    // packet enters it, and the blocks of a leaf are loaded into registers once for all of them,
+    // which pays off when the rays are coherent.
+    void intersect(const Eigen::Vector3f* origins, const Eigen::Vector3f* directions, int numRays,
+                   RayHit* hits, Isa isa = getBestIsa()) const;
+
+    // Closest hits of a packet of rays with the blocks firstBlock up to lastBlock, without the hierarchy
+    void intersectBlocks(long firstBlock, long lastBlock, const Eigen::Vector3f* origins,
+                         const Eigen::Vector3f* directions, int numRays, RayHit* hits, Isa isa = getBestIsa()) const;
+
+    // Calls visitHit(face, t) for every face of a leaf that the ray hits with t in (minT, maxT).
+    // Only rays exactly parallel to a face miss it, unlike with the absolute epsilon of
+    // Utils::rayTriangleIntersect, which would miss the small faces of meshes scaled down to a unit cube.
+    template <typename HitVisitor>
+    void forEachHit(uint32_t nodeIndex, const Eigen::Vector3f& origin, const Eigen::Vector3f& direction,
+                    float minT, float maxT, HitVisitor visitHit, Isa isa = getBestIsa()) const;
+};
+
+template <typename HitVisitor>
+void TriangleBlocks::forEachHit(uint32_t nodeIndex, const Eigen::Vector3f& origin, const Eigen::Vector3f& direction,
+                                float minT, float maxT, HitVisitor visitHit, Isa isa) const {
+    for (uint32_t block = firstBlocks[nodeIndex]; block < firstBlocks[nodeIndex + 1]; block++) {
+        float t[BLOCK_SIZE];
+        int bits = hitLanes(block, origin, direction, minT, maxT, t, isa);
+        for (int lane = 0; bits != 0; lane++, bits >>= 1) {
+            if (bits & 1) {
+                visitHit(blocks[block].faces[lane], t[lane]);
+            }
+        }
+    }
+}
+
+
+#endif //UNTITLED_TRIANGLEBLOCKS_H
@@ -6,6 +6,9 @@
 
 #include <iostream>
 #include <vector>
+#include <cstring>
+#include <sys/stat.h>
+#include <Eigen/Geometry>
 
 std::vector<std::string> Utils::splitString(std::string s, const std::string &delimiter) {
     size_t pos = 0;
@@ -20,8 +23,54 @@ std::vector<std::string> Utils::splitString(std::string s, const std::string &de
     return tokens;
 }
 
-Eigen::MatrixXf Utils::generateScaleMatrix(float factor) {
-    Eigen::MatrixXf transform(4, 4);
+static inline uint64_t rotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t Utils::hashBytes(const void* data, size_t size) {
+    const uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+    const unsigned char* bytes = (const unsigned char*) data;
+
+    // Four independent lanes so the multiplies of consecutive words can overlap
+    uint64_t lanes[4] = {PRIME_1 + PRIME_2, PRIME_2, 0, ~PRIME_1};
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            memcpy(&word, bytes + i + 8 * lane, sizeof(word));
+            lanes[lane] = rotateLeft(lanes[lane] + word * PRIME_2, 31) * PRIME_1;
+        }
+    }
+
+    uint64_t hash = (uint64_t) size * PRIME_1;
+    for (int lane = 0; lane < 4; lane++) {
+        hash = rotateLeft(hash ^ (rotateLeft(lanes[lane] * PRIME_2, 31) * PRIME_1), 27) * PRIME_1 + PRIME_2;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+bool Utils::getFileStamp(const std::string& filePath, uint64_t& size, int64_t& modifiedTime) {
+    struct stat fileStat;
+    if (stat(filePath.c_str(), &fileStat) != 0) {
+        return false;
+    }
+    size = (uint64_t) fileStat.st_size;
+    modifiedTime = (int64_t) fileStat.st_mtime;
+    return true;
+}
+
+Eigen::Matrix4f Utils::generateScaleMatrix(float factor) {
+    Eigen::Matrix4f transform;
     transform <<  factor,    0.,   0.,   0.,
                     0., factor,    0.,   0.,
                     0.,   0., factor,    0.,
@@ -29,8 +78,8 @@ Eigen::MatrixXf Utils::generateScaleMatrix(float factor) {
     return transform;
 }
 
-Eigen::MatrixXf Utils::generateRotationMatrix(int axis, float radians) {
-    Eigen::MatrixXf transform(4, 4);
+Eigen::Matrix4f Utils::generateRotationMatrix(int axis, float radians) {
+    Eigen::Matrix4f transform;
     if (axis == Utils::AXIS_Z){
         transform <<
                  cos(radians),      sin(radians),  0.,  0.,
@@ -54,8 +103,8 @@ Eigen::MatrixXf Utils::generateRotationMatrix(int axis, float radians) {
     return transform;
 }
 
-Eigen::MatrixXf Utils::generateTranslationMatrix(const Eigen::Vector3f &translateBy) {
-    Eigen::MatrixXf transform(4, 4);
+Eigen::Matrix4f Utils::generateTranslationMatrix(const Eigen::Vector3f &translateBy) {
+    Eigen::Matrix4f transform;
     transform <<    1,    0.,   0.,   translateBy(0),
                     0.,   1,    0.,   translateBy(1),
                     0.,   0.,   1,    translateBy(2),
@@ -63,8 +112,8 @@ Eigen::MatrixXf Utils::generateTranslationMatrix(const Eigen::Vector3f &translat
     return transform;
 }
 
-Eigen::MatrixXf Utils::generateScaleAboutPointMatrix(const Eigen::Vector3f& point, float factor) {
-    Eigen::MatrixXf transform(4, 4);
+Eigen::Matrix4f Utils::generateScaleAboutPointMatrix(const Eigen::Vector3f& point, float factor) {
+    Eigen::Matrix4f transform;
     transform <<    factor,    0.,      0.,   point(0) * (1 - factor),
                     0.,     factor,     0.,   point(1) * (1 - factor),
                     0.,       0.,    factor,  point(2) * (1 - factor),
@@ -74,10 +123,17 @@ Eigen::MatrixXf Utils::generateScaleAboutPointMatrix(const Eigen::Vector3f& poin
 
 bool Utils::rayTriangleIntersect(const Eigen::Vector3f &rayOrigin, const Eigen::Vector3f &rayVector, const Eigen::Vector3f &vertex0,
                                  const Eigen::Vector3f &vertex1, const Eigen::Vector3f &vertex2, float& t) {
+    float u, v;
+    return rayTriangleIntersect(rayOrigin, rayVector, vertex0, vertex1, vertex2, t, u, v);
+}
+
+bool Utils::rayTriangleIntersect(const Eigen::Vector3f &rayOrigin, const Eigen::Vector3f &rayVector, const Eigen::Vector3f &vertex0,
+                                 const Eigen::Vector3f &vertex1, const Eigen::Vector3f &vertex2,
+                                 float& t, float& u, float& v) {
     const float EPSILON = 0.00001;
 
     Eigen::Vector3f edge1, edge2, h, s, q;
-    float a,f,u,v;
+    float a,f;
     edge1 = vertex1 - vertex0;
     edge2 = vertex2 - vertex0;
 
@@ -105,7 +161,7 @@ bool Utils::rayTriangleIntersect(const Eigen::Vector3f &rayOrigin, const Eigen::
         return false;
 }
 
-Eigen::MatrixXf Utils::generateRotateAboutPointMatrix(int axis, float radians, const Eigen::Vector3f& center) {
+Eigen::Matrix4f Utils::generateRotateAboutPointMatrix(int axis, float radians, const Eigen::Vector3f& center) {
 //    Eigen::MatrixXf transform(4, 4);
 //    if (axis == Utils::AXIS_Z){
 //        float transX = (-cos(radians)*center(0)) - (sin(radians) * center(1)) + (2 * center(0));
@@ -6,22 +6,43 @@
 #define UNTITLED_UTILS_H
 
 #include <iostream>
+#include <cstdint>
+#include <string>
+#include <vector>
 #include <Eigen/Core>
 
 class Utils {
 public:
     const static int AXIS_Z = 0, AXIS_X = 1, AXIS_Y = 2;
     static std::vector<std::string> splitString(std::string s, const std::string& delimiter);
-    static Eigen::MatrixXf generateScaleMatrix(float factor);
-    static Eigen::MatrixXf generateRotationMatrix(int axis, float radians);
-    static Eigen::MatrixXf generateTranslationMatrix(const Eigen::Vector3f& translateBy);
-    static Eigen::MatrixXf generateScaleAboutPointMatrix(const Eigen::Vector3f& point, float factor);
-    static Eigen::MatrixXf generateRotateAboutPointMatrix(int axis, float radians, const Eigen::Vector3f& center);
+    // Homogeneous transforms are fixed size, so building and composing them never allocates
+    static Eigen::Matrix4f generateScaleMatrix(float factor);
+    static Eigen::Matrix4f generateRotationMatrix(int axis, float radians);
+    static Eigen::Matrix4f generateTranslationMatrix(const Eigen::Vector3f& translateBy);
+    static Eigen::Matrix4f generateScaleAboutPointMatrix(const Eigen::Vector3f& point, float factor);
+    static Eigen::Matrix4f generateRotateAboutPointMatrix(int axis, float radians, const Eigen::Vector3f& center);
     static bool rayTriangleIntersect(
             const Eigen::Vector3f &orig, const Eigen::Vector3f &dir,
             const Eigen::Vector3f &v0, const Eigen::Vector3f &v1, const Eigen::Vector3f &v2, float& t);
+    // Also returns the barycentric coordinates of the hit, which is (1 - u - v) * v0 + u * v1 + v * v2
+    static bool rayTriangleIntersect(
+            const Eigen::Vector3f &orig, const Eigen::Vector3f &dir,
+            const Eigen::Vector3f &v0, const Eigen::Vector3f &v1, const Eigen::Vector3f &v2,
+            float& t, float& u, float& v);
+    // Fast non-cryptographic 64 bit hash, used to detect corrupt or duplicate data
+    static uint64_t hashBytes(const void* data, size_t size);
+    // Size and modification time of a file, false if it does not exist
+    static bool getFileStamp(const std::string& filePath, uint64_t& size, int64_t& modifiedTime);
 };
 
+// Triangle vertex indices, one column per face. Integer storage keeps every index exact
+// past 2^24 vertices, where a float matrix would start rounding them.
+typedef Eigen::Matrix<uint32_t, 3, Eigen::Dynamic> Matrix3Xu;
+
+// Vertex records holding the position in rows 0-2 and the normal in rows 3-5, so a
+// column is one contiguous 24 byte record
+typedef Eigen::Matrix<float, 6, Eigen::Dynamic> Matrix6Xf;
+
 enum RenderType {
     WIREFRAME,
     FLAT_SHADE,
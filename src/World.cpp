@@ -4,11 +4,145 @@
 
 #include "World.h"
 
-void World::addMesh(Mesh& mesh) {
+#include <algorithm>
+
+World::World(const World& other) : meshes(other.meshes), meshIds(other.meshIds), nextMeshId(other.nextMeshId),
+        cameras(other.cameras), viewCamera(other.viewCamera), selection(other.selection),
+        version(other.version) {
+}
+
+int World::addMesh(const Mesh& mesh) {
     meshes.push_back(mesh);
+    meshIds.push_back(nextMeshId);
+    meshBvh.reset();
+    version++;
+    return nextMeshId++;
+}
+
+void World::removeMesh(int meshIndex) {
+    meshes.erase(meshes.begin() + meshIndex);
+    meshIds.erase(meshIds.begin() + meshIndex);
+    meshBvh.reset();
+    version++;
+    auto removed = std::lower_bound(selection.begin(), selection.end(), meshIndex);
+    if (removed != selection.end() && *removed == meshIndex) {
+        removed = selection.erase(removed);
+    }
+    for (auto selected = removed; selected != selection.end(); ++selected) {
+        (*selected)--;
+    }
 }
 
-std::vector<reference_wrapper<Mesh>> World::getMeshes() {
+int World::getMeshIndex(int meshId) const {
+    for (int meshIndex = 0; meshIndex < (int) meshIds.size(); meshIndex++) {
+        if (meshIds[meshIndex] == meshId) {
+            return meshIndex;
+        }
+    }
+    return -1;
+}
+
+int World::getMeshId(int meshIndex) const {
+    return meshIndex == -1 ? -1 : meshIds.at(meshIndex);
+}
+
+uint64_t World::getVersion() const {
+    return version;
+}
+
+void World::updateMesh(int meshIndex) {
+    version++;
+    if (!meshBvh) {
+        return;
+    }
+    Vector3f boundsMin, boundsMax;
+    meshes[meshIndex].getWorldBounds(boundsMin, boundsMax);
+    meshBoundsMin.col(meshIndex) = boundsMin;
+    meshBoundsMax.col(meshIndex) = boundsMax;
+    meshBvh->refit(meshBoundsMin, meshBoundsMax, meshIndex);
+}
+
+void World::updatePickingHierarchy() {
+    if (meshBvh) {
+        return;
+    }
+    meshBoundsMin.resize(3, meshes.size());
+    meshBoundsMax.resize(3, meshes.size());
+    for (int meshIndex = 0; meshIndex < (int) meshes.size(); meshIndex++) {
+        Vector3f boundsMin, boundsMax;
+        meshes[meshIndex].getWorldBounds(boundsMin, boundsMax);
+        meshBoundsMin.col(meshIndex) = boundsMin;
+        meshBoundsMax.col(meshIndex) = boundsMax;
+    }
+    // Intersecting a mesh costs far more than a box, so every mesh gets a leaf of its own
+    meshBvh.reset(new Bvh(meshBoundsMin, meshBoundsMax, 1));
+}
+
+int World::pick(const Vector3f& origin, const Vector3f& direction, RayHit& hit, int hintMeshIndex) {
+    updatePickingHierarchy();
+
+    int closestMeshIndex = -1;
+    if (hintMeshIndex >= 0 && hintMeshIndex < (int) meshes.size() && meshes[hintMeshIndex].intersect(origin, direction, hit)) {
+        closestMeshIndex = hintMeshIndex;
+    }
+    meshBvh->traverse(origin, direction, hit.t, [&](uint32_t meshIndex) {
+        if ((int) meshIndex != hintMeshIndex && meshes[meshIndex].intersect(origin, direction, hit)) {
+            closestMeshIndex = (int) meshIndex;
+        }
+    });
+    return closestMeshIndex;
+}
+
+std::vector<int> World::select(const SelectionFrustum& frustum, bool testTriangles, ThreadPool* pool) {
+    updatePickingHierarchy();
+
+    std::vector<int> selected;
+    std::vector<int> candidates;
+    meshBvh->query([&](const Vector3f& boundsMin, const Vector3f& boundsMax) {
+        return frustum.classifyBounds(boundsMin, boundsMax);
+    }, [&](uint32_t meshIndex, bool contained) {
+        // The world bounds are around the mesh, so a mesh in a contained box is inside as a whole
+        if (contained) {
+            selected.push_back((int) meshIndex);
+        } else {
+            candidates.push_back((int) meshIndex);
+        }
+        return true;
+    });
+
+    std::vector<char> intersects(candidates.size(), 0);
+    ThreadPool::parallelFor(pool, (long) candidates.size(), testTriangles ? 1 : 256, [&](long begin, long end) {
+        for (long i = begin; i < end; i++) {
+            intersects[i] = meshes[candidates[i]].intersects(frustum, testTriangles);
+        }
+    });
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (intersects[i]) {
+            selected.push_back(candidates[i]);
+        }
+    }
+    std::sort(selected.begin(), selected.end());
+    return selected;
+}
+
+bool World::hasPickingHierarchy() const {
+    return meshBvh != nullptr;
+}
+
+void World::takePickingHierarchy(World& copy) {
+    if (meshBvh || !copy.meshBvh || copy.version != version) {
+        return;
+    }
+    meshBvh = std::move(copy.meshBvh);
+    meshBoundsMin = std::move(copy.meshBoundsMin);
+    meshBoundsMax = std::move(copy.meshBoundsMax);
+}
+
+MeshList& World::getMeshes() {
+    return meshes;
+}
+
+const MeshList& World::getMeshes() const {
     return meshes;
 }
 
@@ -16,7 +150,7 @@ void World::addCamera(Camera &camera) {
     cameras.push_back(camera);
 }
 
-std::vector<reference_wrapper<Camera>> World::getCameras() {
+const std::vector<reference_wrapper<Camera>>& World::getCameras() const {
     return cameras;
 }
 
@@ -29,9 +163,30 @@ Camera& World::getViewCamera() {
 }
 
 void World::setSelectedMeshIndex(int meshIndex) {
-    this->selectedMeshIndex = meshIndex;
+    selection.clear();
+    if (meshIndex != -1) {
+        selection.push_back(meshIndex);
+    }
+}
+
+int World::getSelectedMeshIndex() const {
+    return selection.empty() ? -1 : selection.front();
+}
+
+void World::setSelection(const std::vector<int>& meshIndices) {
+    selection = meshIndices;
+    std::sort(selection.begin(), selection.end());
+    selection.erase(std::unique(selection.begin(), selection.end()), selection.end());
+}
+
+const std::vector<int>& World::getSelection() const {
+    return selection;
+}
+
+bool World::isSelected(int meshIndex) const {
+    return std::binary_search(selection.begin(), selection.end(), meshIndex);
 }
 
-int World::getSelectedMeshIndex() {
-    return this->selectedMeshIndex;
+void World::clearSelection() {
+    selection.clear();
 }
\ No newline at end of file
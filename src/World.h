@@ -9,32 +9,91 @@
 #include "Camera.h"
 #include <iostream>
 #include <Eigen/Core>
+#include <memory>
 #include <vector>
+#include "Bvh.h"
+#include "SelectionFrustum.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 
 class World {
 private:
-    std::vector<std::reference_wrapper<Mesh>> meshes;
+    MeshList meshes;
+    std::vector<int> meshIds;
+    int nextMeshId = 0;
     std::vector<reference_wrapper<Camera>> cameras;
     int viewCamera = 0;
-    int selectedMeshIndex = -1;
+    // Sorted indices of the selected meshes
+    std::vector<int> selection;
+    uint64_t version = 0;
+
+    // Two level picking: a hierarchy over the world bounds of the meshes leads to the shared
+    // hierarchies of their geometries. It is rebuilt when meshes are added or removed and
+    // refitted when one moves. Null until the next pick after a rebuild was needed.
+    std::unique_ptr<Bvh> meshBvh;
+    Eigen::Matrix3Xf meshBoundsMin;
+    Eigen::Matrix3Xf meshBoundsMax;
 
 public:
-    void addMesh(Mesh& mesh);
+    World() = default;
+    // Copies the meshes but not the picking hierarchy, which the copy builds on its first pick.
+    // A copy can be picked on another thread while this world keeps changing.
+    World(const World& other);
+
+    // Returns an id that keeps identifying the mesh when other meshes are removed
+    int addMesh(const Mesh& mesh);
+
+    void removeMesh(int meshIndex);
+
+    // Index of the mesh with the given id, -1 if it has been removed
+    int getMeshIndex(int meshId) const;
+    int getMeshId(int meshIndex) const;
+
+    // Changes whenever a mesh is added, removed or moved
+    uint64_t getVersion() const;
+
+    // Has to be called after the model of a mesh returned by getMeshes is changed, so picking
+    // sees the mesh where it is drawn
+    void updateMesh(int meshIndex);
+
+    // Index of the mesh with the closest hit of the ray origin + t * direction, if it is closer
+    // than hit.t, or -1. The hint mesh is intersected first, when the ray still hits the mesh
+    // found by the previous pick that bounds the search and most of the scene is skipped.
+    int pick(const Vector3f& origin, const Vector3f& direction, RayHit& hit, int hintMeshIndex = -1);
+    // Indices of the meshes inside the selection region, in ascending order. The hierarchy over the
+    // meshes rejects or accepts whole groups of them by their bounds, only meshes on the border of
+    // the region are tested on their own, in parallel with a pool.
+    std::vector<int> select(const SelectionFrustum& frustum, bool testTriangles, ThreadPool* pool = nullptr);
+    // Builds the picking hierarchy if it is missing. Until the world is changed again, pick and
+    // select only read it and may run on several threads at once.
+    void updatePickingHierarchy();
+    // False from adding or removing a mesh until the next pick has rebuilt the hierarchy
+    bool hasPickingHierarchy() const;
+    // Moves over the hierarchy a copy of this world has built, if nothing has changed since the
+    // copy was made, so a rebuild on another thread spares this world its own
+    void takePickingHierarchy(World& copy);
 
     void addCamera(Camera& camera);
 
-    std::vector<reference_wrapper<Mesh>> getMeshes();
+    MeshList& getMeshes();
+    const MeshList& getMeshes() const;
 
-    std::vector<reference_wrapper<Camera>> getCameras();
+    const std::vector<reference_wrapper<Camera>>& getCameras() const;
 
     void setViewCamera(int cameraNumber);
 
     Camera& getViewCamera();
 
+    // Selects only this mesh, or nothing for -1
     void setSelectedMeshIndex(int meshIndex);
 
-    int getSelectedMeshIndex();
+    // First selected mesh, -1 if nothing is selected
+    int getSelectedMeshIndex() const;
+
+    void setSelection(const std::vector<int>& meshIndices);
+    const std::vector<int>& getSelection() const;
+    bool isSelected(int meshIndex) const;
+    void clearSelection();
 };
 
 
@@ -5,6 +5,17 @@
 #include "Mesh.h"
 #include "Utils.h"
 #include "World.h"
+#include "MeshCache.h"
+#include "MeshLoader.h"
+#include "AssetRegistry.h"
+#include "HoverPicker.h"
+#include "RayTracer.h"
+#include "AmbientOcclusionBake.h"
+#include "AllocationCounter.h"
+#include "GpuGeometryCache.h"
+#include "StreamBuffer.h"
+#include "InstanceBatches.h"
+#include "RenderQueue.h"
 
 #ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION
@@ -20,11 +31,51 @@
 #include <Eigen/Core>
 
 // Timer
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <unordered_set>
 
 
 World world;
+MeshLoader meshLoader;
+HoverPicker hoverPicker;
+// Ambient occlusion bakes of whole geometries, the first one runs a few milliseconds per frame
+vector<unique_ptr<AmbientOcclusionBake>> occlusionBakes;
+const double OCCLUSION_BAKE_MILLISECONDS_PER_FRAME = 4.0;
+// Meshes switched to wobbling with M, their vertices are recomputed every frame
+unordered_set<int> deformingMeshIds;
+// Of the diagonal of the bounds
+const float DEFORM_AMPLITUDE = 0.02f;
+
+// std140 layouts of the uniform blocks of the shader. The frame block is written once per frame,
+// every draw selects a draw block of its own. Transformations and colors are per instance inputs.
+struct FrameUniforms {
+    Matrix4f view;
+    Matrix4f projection;
+    Vector4f lightPos;
+    Vector4f viewPos;
+    // Width and height of the framebuffer in pixels
+    Vector4f viewport;
+};
+struct DrawUniforms {
+    int32_t flatNormal;
+    int32_t bakedOcclusion;
+    int32_t padding[2];
+};
+const GLuint FRAME_UNIFORMS_BINDING = 0;
+const GLuint DRAW_UNIFORMS_BINDING = 1;
+// Bits of the shader variants, one draw block each. Edges are drawn by the geometry shader, so
+// VARIANT_EDGES picks the program instead of a flag of the block.
+const unsigned VARIANT_FLAT_NORMAL = 1;
+const unsigned VARIANT_BAKED_OCCLUSION = 2;
+const unsigned VARIANT_EDGES = 4;
+const unsigned NUM_VARIANTS = 8;
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
@@ -33,16 +84,160 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 Vector3f rayOrigin(0.0, 0.0, 0.0);
 Vector3f rayDirection(0.0, 0.0, 0.0);
 
-//vector<Mesh> meshes;
-Mesh meshes[100] = {Mesh()};
-int meshArrayTop = 0;
-
 bool isCameraMovingInCartesianCoords = false;
 
-Vector3f screenCoordsToWorldCoords(GLFWwindow* window, Vector3d screenCoords) {
-    // Get the size of the window
+// Cursor movement below this many pixels between press and release is a click, not a drag
+const double MIN_DRAG_PIXELS = 4;
+bool isDragging = false;
+bool isLassoDrag = false;
+Vector2d dragStart(0.0, 0.0);
+// In normalized device coordinates
+vector<Vector2f> lassoOutline;
+// Rectangle and lasso selections, reported at exit
+long numSelections = 0;
+double totalSelectionMilliseconds = 0;
+double maxSelectionMilliseconds = 0;
+
+// Shows a box where the mesh will appear and swaps the mesh in once it has loaded in the background
+void loadMeshAsync(const string& filePath, const Vector3f& color, const RenderType& renderType,
+                   const Vector3f& translation) {
+    // Further instances of an asset that is already loaded share its geometry and appear at once
+    shared_ptr<const Geometry> geometry = AssetRegistry::shared().find(filePath);
+    if (geometry) {
+        Mesh mesh(geometry, color, renderType);
+        mesh.scaleToUnitCube();
+        mesh.translate(translation);
+        world.addMesh(mesh);
+        return;
+    }
+
+    // The real bounds are known up front if the mesh has been cached
+    Vector3f boundsMin(-0.5, -0.5, -0.5), boundsMax(0.5, 0.5, 0.5);
+    MeshCache::readBounds(filePath, boundsMin, boundsMax);
+
+    Mesh placeholder = Mesh::box(boundsMin, boundsMax, color, WIREFRAME);
+    placeholder.scaleToUnitCube();
+    placeholder.translate(translation);
+    int placeholderId = world.addMesh(placeholder);
+
+    meshLoader.load(filePath, color, renderType, [placeholderId](Mesh* mesh) {
+        int meshIndex = world.getMeshIndex(placeholderId);
+        if (meshIndex == -1) {
+            return;
+        }
+        if (mesh == nullptr) {
+            world.removeMesh(meshIndex);
+            return;
+        }
+        // Keep any transformation applied to the placeholder while the mesh was loading
+        Mesh& placeholder = world.getMeshes().at(meshIndex);
+        float rescale = mesh->getUnitCubeScale() / placeholder.getUnitCubeScale();
+        mesh->setModel(placeholder.getModel() * Utils::generateScaleMatrix(rescale));
+        placeholder = *mesh;
+        world.updateMesh(meshIndex);
+    });
+}
+
+// Shows the progress of background loads in the title bar
+void updateWindowTitle(GLFWwindow* window) {
+    static string currentTitle;
+    string title = "Hello World";
+    for (const shared_ptr<MeshLoadRequest>& request : meshLoader.getPendingRequests()) {
+        title += "  |  Loading " + request->getFilePath() + " " + to_string((int) (100 * request->getProgress())) + "%";
+    }
+    for (const unique_ptr<AmbientOcclusionBake>& bake : occlusionBakes) {
+        title += "  |  Baking occlusion " + to_string((int) (100 * bake->getProgress())) + "%";
+    }
+    if (title != currentTitle) {
+        glfwSetWindowTitle(window, title.c_str());
+        currentTitle = title;
+    }
+}
+
+// Queues a bake for the geometry of every selected mesh that has no ambient occlusion yet. Instances
+// share their geometry, so one bake covers all of them.
+void bakeSelectedOcclusion() {
+    for (int meshIndex : world.getSelection()) {
+        const shared_ptr<const Geometry>& geometry = world.getMeshes().at(meshIndex).getGeometry();
+        bool queued = geometry->getAmbientOcclusion() != nullptr;
+        for (const unique_ptr<AmbientOcclusionBake>& bake : occlusionBakes) {
+            queued = queued || bake->getGeometry() == geometry;
+        }
+        if (!queued) {
+            occlusionBakes.emplace_back(new AmbientOcclusionBake(geometry));
+        }
+    }
+}
+
+// Runs the first queued bake for a few milliseconds and caches its result once it is done
+void stepOcclusionBakes() {
+    if (occlusionBakes.empty()) {
+        return;
+    }
+    AmbientOcclusionBake& bake = *occlusionBakes.front();
+    if (!bake.isCancelled() && !bake.step(OCCLUSION_BAKE_MILLISECONDS_PER_FRAME, &ThreadPool::shared())) {
+        return;
+    }
+    if (bake.isDone()) {
+        cout << "Baked ambient occlusion of " << bake.getGeometry()->getVertices().cols() << " vertices: "
+             << bake.getNumRays() << " rays in " << bake.getSeconds() * 1000 << " ms, "
+             << bake.getRaysPerSecond() / 1e6 << " M rays/s" << endl;
+        const string& sourcePath = bake.getGeometry()->getSourcePath();
+        if (!sourcePath.empty()) {
+            MeshCache::write(sourcePath, *bake.getGeometry());
+        }
+    }
+    occlusionBakes.erase(occlusionBakes.begin());
+}
+
+// Moves the vertices along their normals by a wave that runs up the geometry over time, written
+// straight to positions
+void deformVertices(const Geometry& geometry, float time, float* positions) {
+    const Matrix3Xf& vertices = geometry.getVertices();
+    const Matrix3Xf& normals = geometry.getVertexNormals();
+    Vector3f size = geometry.getBoundsMax() - geometry.getBoundsMin();
+    float amplitude = DEFORM_AMPLITUDE * size.norm();
+    float frequency = (float) (6 * M_PI) / max(size(1), 1e-6f);
+    float bottom = geometry.getBoundsMin()(1);
+    Map<Matrix3Xf> deformed(positions, 3, vertices.cols());
+    auto deform = [&](long begin, long end) {
+        for (long vertex = begin; vertex < end; vertex++) {
+            float wave = sin(frequency * (vertices(1, vertex) - bottom) - 4 * time);
+            deformed.col(vertex) = vertices.col(vertex) + amplitude * wave * normals.col(vertex);
+        }
+    };
+    // By reference, the std::function would allocate a copy of all captures every frame
+    ThreadPool::parallelFor(&ThreadPool::shared(), vertices.cols(), 4096, ref(deform));
+}
+
+bool isDeforming(int meshIndex) {
+    return deformingMeshIds.count(world.getMeshId(meshIndex)) != 0;
+}
+
+// Bytes of deformed vertices streamed since the start, the stream buffer carries uniforms and
+// instances as well
+long streamedVertexBytes = 0;
+
+// Deforms the vertices of a wobbling batch into stream, returns their offset
+GLintptr streamDeformedVertices(StreamBuffer& stream, const InstanceBatches::Batch& batch, float time) {
+    GLintptr offset;
+    size_t bytes = sizeof(float) * batch.geometry->getVertices().size();
+    streamedVertexBytes += bytes;
+    void* positions = stream.map(bytes, offset);
+    deformVertices(*batch.geometry, time, (float*) positions);
+    stream.unmap();
+    return offset;
+}
+
+Vector2i getWindowSize(GLFWwindow* window) {
     int width, height;
     glfwGetWindowSize(window, &width, &height);
+    return Vector2i(width, height);
+}
+
+Vector3f screenCoordsToWorldCoords(const Vector2i& windowSize, Vector3d screenCoords) {
+    int width = windowSize(0);
+    int height = windowSize(1);
 
     double xpos = screenCoords(0);
     double ypos = screenCoords(1);
@@ -57,48 +252,83 @@ Vector3f screenCoordsToWorldCoords(GLFWwindow* window, Vector3d screenCoords) {
     return Vector3f(p_world(0), p_world(1), p_world(2));
 }
 
+// World space ray through a cursor position in a window of windowSize
+void cursorRay(const Vector2i& windowSize, double xpos, double ypos, Vector3f& origin, Vector3f& direction) {
+    Vector3f worldPoint = screenCoordsToWorldCoords(windowSize, Vector3d(xpos, ypos, 0.0));
+    Vector3f worldPoint2;
+    if (world.getViewCamera().getProjectionType() == Camera::PROJECTION_PERSPECTIVE) {
+        worldPoint2 = world.getViewCamera().getCameraPosition();
+    } else {
+        worldPoint2 = screenCoordsToWorldCoords(windowSize, Vector3d(xpos, ypos, 1.0));
+    }
+    origin = worldPoint;
+    direction = (worldPoint - worldPoint2).normalized();
+}
+
+// Normalized device coordinates of a cursor position
+Vector2f cursorToScreen(GLFWwindow* window, double xpos, double ypos) {
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+    return Vector2f(xpos / width * 2 - 1, (height - 1 - ypos) / height * 2 - 1);
+}
+
+// Applies a change to every selected mesh and keeps picking in step with it
+void forEachSelectedMesh(const function<void(Mesh&)>& change) {
+    for (int meshIndex : world.getSelection()) {
+        change(world.getMeshes().at(meshIndex));
+        world.updateMesh(meshIndex);
+    }
+}
+
+// A click picks the mesh under the cursor. Dragging selects every mesh in the rectangle, or with
+// control held in the lasso drawn by the cursor. With shift held the triangles of the meshes are
+// tested instead of their bounds.
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+    if (button != GLFW_MOUSE_BUTTON_LEFT) {
+        return;
+    }
+    double xpos, ypos;
+    glfwGetCursorPos(window, &xpos, &ypos);
+    if (action == GLFW_PRESS) {
+        isDragging = true;
+        isLassoDrag = (mods & GLFW_MOD_CONTROL) != 0;
+        dragStart = Vector2d(xpos, ypos);
+        lassoOutline.assign(1, cursorToScreen(window, xpos, ypos));
+        return;
+    }
+    if (action != GLFW_RELEASE || !isDragging) {
+        return;
+    }
+    isDragging = false;
 
-    // Update the position of the first vertex if the left button is pressed
-    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS){
-        double xpos, ypos;
-        glfwGetCursorPos(window, &xpos, &ypos);
-        Vector3f worldPoint = screenCoordsToWorldCoords(window, Vector3d(xpos, ypos, 0.0));
-        Vector3f worldPoint2;
-        if (world.getViewCamera().getProjectionType() == Camera::PROJECTION_PERSPECTIVE) {
-            worldPoint2 = world.getViewCamera().getCameraPosition();
-        } else {
-            worldPoint2 = screenCoordsToWorldCoords(window, Vector3d(xpos, ypos, 1.0));
-        }
+    if ((Vector2d(xpos, ypos) - dragStart).norm() < MIN_DRAG_PIXELS) {
+        cursorRay(getWindowSize(window), xpos, ypos, rayOrigin, rayDirection);
+        RayHit closestHit;
+        world.setSelectedMeshIndex(world.pick(rayOrigin, rayDirection, closestHit));
+        return;
+    }
 
-        rayOrigin = worldPoint;
-        rayDirection = (worldPoint - worldPoint2).normalized();
-
-        int closestMeshIntersectedIndex = -1;
-        float closestMeshDistance = 999999.0;
-        for (int meshNo = 0; meshNo < world.getMeshes().size(); meshNo++) {
-            Mesh mesh = world.getMeshes().at(meshNo).get();
-            MatrixXf model = mesh.getModel();
-            MatrixXf triangles = mesh.getTriangleVertices();
-            for (long i = 0; i < triangles.cols(); i += 3) {
-                Vector4f a4 = model * Vector4f(triangles.col(i)(0), triangles.col(i)(1), triangles.col(i)(2), 1.0);
-                Vector4f b4 = model * Vector4f(triangles.col(i+1)(0), triangles.col(i+1)(1), triangles.col(i+1)(2), 1.0);
-                Vector4f c4 = model * Vector4f(triangles.col(i+2)(0), triangles.col(i+2)(1), triangles.col(i+2)(2), 1.0);
-
-                Vector3f a = Vector3f(a4(0), a4(1), a4(2));
-                Vector3f b = Vector3f(b4(0), b4(1), b4(2));
-                Vector3f c = Vector3f(c4(0), c4(1), c4(2));
-                float t = -1;
-                if (Utils::rayTriangleIntersect(rayOrigin, rayDirection, a, b, c, t)) {
-                    if (t < closestMeshDistance) {
-                        closestMeshDistance = t;
-                        closestMeshIntersectedIndex = meshNo;
-                    }
-                }
-            }
+    Camera& camera = world.getViewCamera();
+    Matrix4f clip = camera.getProjection() * camera.getView();
+    bool testTriangles = (mods & GLFW_MOD_SHIFT) != 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    vector<int> selection;
+    if (isLassoDrag) {
+        lassoOutline.push_back(cursorToScreen(window, xpos, ypos));
+        if (lassoOutline.size() >= 3) {
+            selection = world.select(SelectionFrustum::lasso(clip, lassoOutline), testTriangles, &ThreadPool::shared());
         }
-        world.setSelectedMeshIndex(closestMeshIntersectedIndex);
+    } else {
+        SelectionFrustum frustum = SelectionFrustum::rectangle(clip, cursorToScreen(window, dragStart(0), dragStart(1)),
+                                                               cursorToScreen(window, xpos, ypos));
+        selection = world.select(frustum, testTriangles, &ThreadPool::shared());
     }
+    auto end = std::chrono::high_resolution_clock::now();
+    world.setSelection(selection);
+    double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    numSelections++;
+    totalSelectionMilliseconds += milliseconds;
+    maxSelectionMilliseconds = max(maxSelectionMilliseconds, milliseconds);
 }
 
 
@@ -107,29 +337,25 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     switch (key) {
         case GLFW_KEY_1:
             if (action == GLFW_PRESS) {
-                meshes[meshArrayTop] = Mesh::fromOffFile("../data/unit_cube.off", Vector3f(1.0, 1.0, 0.0), FLAT_SHADE);
-                meshes[meshArrayTop].scaleToUnitCube();
-                meshes[meshArrayTop].translate(Vector3f(0.0, 0.0, 0.0));
-                world.addMesh(meshes[meshArrayTop]);
-                meshArrayTop++;
+                loadMeshAsync("../data/unit_cube.off", Vector3f(1.0, 1.0, 0.0), FLAT_SHADE, Vector3f(0.0, 0.0, 0.0));
             }
             break;
         case GLFW_KEY_2:
             if (action == GLFW_PRESS) {
-                meshes[meshArrayTop] = Mesh::fromOffFile("../data/bunny.off", Vector3f(0.0, 1.0, 0.0), FLAT_SHADE);
-                meshes[meshArrayTop].scaleToUnitCube();
-                meshes[meshArrayTop].translate(Vector3f(-0.072, -0.1, 0.0));
-                world.addMesh(meshes[meshArrayTop]);
-                meshArrayTop++;
+                loadMeshAsync("../data/bunny.off", Vector3f(0.0, 1.0, 0.0), FLAT_SHADE, Vector3f(-0.072, -0.1, 0.0));
             }
             break;
         case GLFW_KEY_3:
             if (action == GLFW_PRESS) {
-                meshes[meshArrayTop] = Mesh::fromOffFile("../data/bumpy_cube.off", Vector3f(1.0, 0.0, 0.0), FLAT_SHADE);
-                meshes[meshArrayTop].scaleToUnitCube();
-                meshes[meshArrayTop].translate(Vector3f(0.0, 0.0, 0.0));
-                world.addMesh(meshes[meshArrayTop]);
-                meshArrayTop++;
+                loadMeshAsync("../data/bumpy_cube.off", Vector3f(1.0, 0.0, 0.0), FLAT_SHADE, Vector3f(0.0, 0.0, 0.0));
+            }
+            break;
+        case GLFW_KEY_ESCAPE:
+            if (action == GLFW_PRESS) {
+                meshLoader.cancelAll();
+                for (const unique_ptr<AmbientOcclusionBake>& bake : occlusionBakes) {
+                    bake->cancel();
+                }
             }
             break;
 
@@ -187,100 +413,119 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
             break;
         case GLFW_KEY_LEFT_SHIFT:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                Mesh& mesh = world.getMeshes().at(world.getSelectedMeshIndex()).get();
-                if (mesh.getRenderType() == PHONG_SHADE) mesh.setRenderType(WIREFRAME);
-                else if (mesh.getRenderType() == WIREFRAME) mesh.setRenderType(FLAT_SHADE);
-                else if (mesh.getRenderType() == FLAT_SHADE) mesh.setRenderType(PHONG_SHADE);
+                forEachSelectedMesh([](Mesh& mesh) {
+                    if (mesh.getRenderType() == PHONG_SHADE) mesh.setRenderType(WIREFRAME);
+                    else if (mesh.getRenderType() == WIREFRAME) mesh.setRenderType(FLAT_SHADE);
+                    else if (mesh.getRenderType() == FLAT_SHADE) mesh.setRenderType(PHONG_SHADE);
+                });
             }
             break;
         case  GLFW_KEY_A:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().translate(Vector3f(-0.1, 0, 0.0));
+                forEachSelectedMesh([](Mesh& mesh) { mesh.translate(Vector3f(-0.1, 0, 0.0)); });
             }
             break;
         case  GLFW_KEY_D:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().translate(Vector3f(0.1, 0, 0.0));
+                forEachSelectedMesh([](Mesh& mesh) { mesh.translate(Vector3f(0.1, 0, 0.0)); });
             }
             break;
         case  GLFW_KEY_W:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().translate(Vector3f(0.0, 0.0, -0.1));
+                forEachSelectedMesh([](Mesh& mesh) { mesh.translate(Vector3f(0.0, 0.0, -0.1)); });
             }
             break;
         case  GLFW_KEY_S:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().translate(Vector3f(0.0, 0, 0.1));
+                forEachSelectedMesh([](Mesh& mesh) { mesh.translate(Vector3f(0.0, 0, 0.1)); });
             }
             break;
         case  GLFW_KEY_Q:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().translate(Vector3f(0.0, 0.1, 0.0));
+                forEachSelectedMesh([](Mesh& mesh) { mesh.translate(Vector3f(0.0, 0.1, 0.0)); });
             }
             break;
         case  GLFW_KEY_Z:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().translate(Vector3f(0.0, -0.1, 0.0));
+                forEachSelectedMesh([](Mesh& mesh) { mesh.translate(Vector3f(0.0, -0.1, 0.0)); });
             }
             break;
         case  GLFW_KEY_E:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().rotate(Utils::AXIS_Z, -0.1);
+                forEachSelectedMesh([](Mesh& mesh) { mesh.rotate(Utils::AXIS_Z, -0.1); });
             }
             break;
         case  GLFW_KEY_R:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().rotate(Utils::AXIS_Z, 0.1);
+                forEachSelectedMesh([](Mesh& mesh) { mesh.rotate(Utils::AXIS_Z, 0.1); });
             }
             break;
         case  GLFW_KEY_F:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().rotate(Utils::AXIS_X, -0.1);
+                forEachSelectedMesh([](Mesh& mesh) { mesh.rotate(Utils::AXIS_X, -0.1); });
             }
             break;
         case  GLFW_KEY_G:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().rotate(Utils::AXIS_X, 0.1);
+                forEachSelectedMesh([](Mesh& mesh) { mesh.rotate(Utils::AXIS_X, 0.1); });
             }
             break;
         case  GLFW_KEY_C:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().rotate(Utils::AXIS_Y, -0.1);
+                forEachSelectedMesh([](Mesh& mesh) { mesh.rotate(Utils::AXIS_Y, -0.1); });
             }
             break;
         case  GLFW_KEY_V:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().rotate(Utils::AXIS_Y, 0.1);
+                forEachSelectedMesh([](Mesh& mesh) { mesh.rotate(Utils::AXIS_Y, 0.1); });
+            }
+            break;
+        case  GLFW_KEY_O:
+            if (action == GLFW_PRESS) {
+                bakeSelectedOcclusion();
+            }
+            break;
+        case  GLFW_KEY_M:
+            if (action == GLFW_PRESS) {
+                for (int meshIndex : world.getSelection()) {
+                    int meshId = world.getMeshId(meshIndex);
+                    if (deformingMeshIds.erase(meshId) == 0) {
+                        deformingMeshIds.insert(meshId);
+                    }
+                }
+            }
+            break;
+        case  GLFW_KEY_H:
+            if (action == GLFW_PRESS) {
+                hoverPicker.setEnabled(!hoverPicker.isEnabled());
             }
             break;
         case  GLFW_KEY_P:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().scale(1.1);
+                forEachSelectedMesh([](Mesh& mesh) { mesh.scale(1.1); });
             }
             break;
         case  GLFW_KEY_L:
             if (action == GLFW_PRESS) {
-                if (world.getSelectedMeshIndex() == -1) return;
-                world.getMeshes().at(world.getSelectedMeshIndex()).get().scale(1/1.1);
+                forEachSelectedMesh([](Mesh& mesh) { mesh.scale(1/1.1); });
             }
             break;
     }
 }
 
+void cursor_position_callback(GLFWwindow* window, double xpos, double ypos) {
+    hoverPicker.moveCursor(xpos, ypos);
+    if (isDragging && isLassoDrag) {
+        // Points closer than a pixel or two add nothing to the outline but cost every test
+        Vector2f point = cursorToScreen(window, xpos, ypos);
+        int width, height;
+        glfwGetWindowSize(window, &width, &height);
+        if ((point - lassoOutline.back()).cwiseProduct(Vector2f(width, height) / 2).norm() >= 2) {
+            lassoOutline.push_back(point);
+        }
+    }
+}
+
 void window_size_callback(GLFWwindow* window, int width, int height) {
     world.getViewCamera().setAspectRatio((float)width / (float)height);
 }
@@ -298,32 +543,472 @@ GLenum getPolygonDrawType(RenderType renderType) {
     }
 }
 
-int main()
+// What frames reuse from one to the next, so that a frame does not allocate once warmed up
+struct FrameResources {
+    // Uniform blocks, instances and positions of deforming meshes, written by the CPU every frame
+    // while earlier frames still draw
+    StreamBuffer streamBuffer;
+    size_t uniformAlignment = 256;
+    // Meshes of the same geometry and render type are drawn with one instanced call
+    InstanceBatches instanceBatches;
+    // Draws of the batches, sorted to change as little state as possible. Edges pick the program.
+    RenderQueue renderQueue{VARIANT_EDGES};
+    // Of the deformed vertices of every batch, -1 for batches that read their geometry
+    vector<GLintptr> streamedPositions;
+    GLintptr frameUniformsOffset = 0;
+};
+
+// Everything a frame does before it draws: answers the hover query, writes the frame and draw
+// uniform blocks, instances and deformed vertices into the stream buffer, and fills and sorts the
+// render queue. Nothing is bound, the render loop submits the queue and checkAllocations runs the
+// same frames on a stream buffer in memory.
+void prepareFrame(FrameResources& frame, const Vector2i& windowSize, const Vector2i& framebufferSize, float time) {
+    // At most one hover query per frame, for the latest cursor position
+    double hoverX, hoverY;
+    if (hoverPicker.update(world, hoverX, hoverY)) {
+        Vector3f hoverOrigin, hoverDirection;
+        cursorRay(windowSize, hoverX, hoverY, hoverOrigin, hoverDirection);
+        hoverPicker.pick(world, hoverOrigin, hoverDirection);
+    }
+
+    StreamBuffer& streamBuffer = frame.streamBuffer;
+    const size_t uniformAlignment = frame.uniformAlignment;
+    const size_t drawUniformsStride = (sizeof(DrawUniforms) + uniformAlignment - 1) / uniformAlignment * uniformAlignment;
+    streamBuffer.beginFrame();
+
+    // Everything this frame writes has to fit before the first offset is bound
+    const MeshList& meshes = world.getMeshes();
+    size_t frameBytes = StreamBuffer::paddedBytes(sizeof(FrameUniforms), uniformAlignment)
+            + StreamBuffer::paddedBytes(NUM_VARIANTS * drawUniformsStride, uniformAlignment)
+            + InstanceBatches::streamBytes(meshes.size());
+    for (int meshIndex = 0; meshIndex < (int) meshes.size(); meshIndex++) {
+        if (isDeforming(meshIndex)) {
+            frameBytes += StreamBuffer::paddedBytes(sizeof(float) * meshes[meshIndex].getVertices().size());
+        }
+    }
+    streamBuffer.reserve(frameBytes);
+
+    //Set the camera view and the light, which are the same for every draw
+    const Camera& viewCamera = world.getViewCamera();
+    FrameUniforms frameUniforms;
+    frameUniforms.view = viewCamera.getView();
+    frameUniforms.projection = viewCamera.getProjection();
+    frameUniforms.lightPos << -5.0, 0.0, 10.0, 1.0;
+    frameUniforms.viewPos << viewCamera.getCameraPosition(), 1.0;
+    frameUniforms.viewport << framebufferSize.cast<float>(), 0.0, 0.0;
+    memcpy(streamBuffer.map(sizeof(FrameUniforms), frame.frameUniformsOffset, uniformAlignment), &frameUniforms,
+           sizeof(FrameUniforms));
+    streamBuffer.unmap();
+
+    int hoveredMeshIndex = world.getMeshIndex(hoverPicker.getHoveredMeshId());
+    frame.instanceBatches.build(meshes, [&](int meshIndex) -> Vector3f {
+        if (world.isSelected(meshIndex)) {
+            return Vector3f(0.0, 0.0, 1.0);
+        } else if (hoveredMeshIndex == meshIndex) {
+            return (meshes[meshIndex].getColor() + Vector3f::Ones()) / 2;
+        }
+        return meshes[meshIndex].getColor();
+    }, isDeforming, frameUniforms.view, streamBuffer);
+    const vector<InstanceBatches::Batch>& batches = frame.instanceBatches.getBatches();
+
+    // The draw blocks of all variants, draws of the same variant share one
+    GLintptr drawUniformsOffset;
+    char* drawUniforms = (char*) streamBuffer.map(NUM_VARIANTS * drawUniformsStride, drawUniformsOffset,
+                                                  uniformAlignment);
+    for (unsigned variant = 0; variant < NUM_VARIANTS; variant++) {
+        DrawUniforms draw;
+        draw.flatNormal = (variant & VARIANT_FLAT_NORMAL) != 0;
+        draw.bakedOcclusion = (variant & VARIANT_BAKED_OCCLUSION) != 0;
+        memcpy(drawUniforms + variant * drawUniformsStride, &draw, sizeof(DrawUniforms));
+    }
+    streamBuffer.unmap();
+
+    // Flat shaded meshes draw their black edges in the same pass as their faces
+    RenderQueue& renderQueue = frame.renderQueue;
+    renderQueue.clear();
+    frame.streamedPositions.assign(batches.size(), -1);
+    for (int batchIndex = 0; batchIndex < (int) batches.size(); batchIndex++) {
+        const InstanceBatches::Batch& batch = batches[batchIndex];
+        if (batch.streamedMeshIndex != -1) {
+            frame.streamedPositions[batchIndex] = streamDeformedVertices(streamBuffer, batch, time);
+        }
+        unsigned variant = (batch.renderType != PHONG_SHADE ? VARIANT_FLAT_NORMAL : 0)
+                | (batch.geometry->getAmbientOcclusion() ? VARIANT_BAKED_OCCLUSION : 0)
+                | (batch.renderType == FLAT_SHADE ? VARIANT_EDGES : 0);
+        GLenum polygonMode = getPolygonDrawType(batch.renderType);
+        RenderQueue::Draw draw;
+        draw.key = renderQueue.makeKey(polygonMode == GL_LINE, variant, batch.renderType, batch.geometryIndex,
+                                       batch.depth);
+        draw.batchIndex = batchIndex;
+        draw.numInstances = batch.numInstances;
+        draw.polygonMode = polygonMode;
+        draw.uniformsOffset = drawUniformsOffset + variant * drawUniformsStride;
+        renderQueue.push(draw);
+    }
+    renderQueue.sort();
+}
+
+// Renders the meshes of keys 1, 2 and 3 from the start position of the camera without opening a
+// window, once for every thread count up to the number of cores
+int renderHeadless(const string& filePath, int width, int height) {
+    world.addMesh(Mesh::fromOffFile("../data/unit_cube.off", Vector3f(1.0, 1.0, 0.0), FLAT_SHADE));
+    world.addMesh(Mesh::fromOffFile("../data/bunny.off", Vector3f(0.0, 1.0, 0.0), FLAT_SHADE));
+    world.addMesh(Mesh::fromOffFile("../data/bumpy_cube.off", Vector3f(1.0, 0.0, 0.0), FLAT_SHADE));
+    for (int meshIndex = 0; meshIndex < (int) world.getMeshes().size(); meshIndex++) {
+        world.getMeshes()[meshIndex].scaleToUnitCube();
+    }
+    world.getMeshes()[1].translate(Vector3f(-0.072, -0.1, 0.0));
+    Camera camera(Vector3f(0., 0., 3.), Vector3f(0., 0., 0.),
+            Camera::PROJECTION_PERSPECTIVE, (float)width / (float)height, -0.5, -100.0, (3.14/180) * 90);
+
+    RayTracer rayTracer(width, height);
+    unsigned maxThreads = max(1u, thread::hardware_concurrency());
+    for (unsigned threads = 1; ; threads = min(threads * 2, maxThreads)) {
+        unique_ptr<ThreadPool> pool(threads > 1 ? new ThreadPool(threads) : nullptr);
+        rayTracer.render(world, camera, pool.get());
+        cout << threads << " threads: " << rayTracer.getNumRays() << " rays in " << rayTracer.getSeconds() * 1000
+             << " ms, " << rayTracer.getRaysPerSecond() / 1e6 << " M rays/s" << endl;
+        if (threads == maxThreads) {
+            break;
+        }
+    }
+    rayTracer.writePpm(filePath);
+    cout << "Wrote " << filePath << endl;
+    return 0;
+}
+
+// Runs the frames of the render loop up to their GL calls, with a stream buffer in memory and the
+// cursor moving over the meshes for hover picking, and fails if they allocate after a warm up.
+// Needs a build with COUNT_ALLOCATIONS, and assertions enabled for Eigen matrices, which do not
+// allocate through operator new.
+int checkAllocations() {
+#if defined(COUNT_ALLOCATIONS) && defined(EIGEN_RUNTIME_NO_MALLOC) && !defined(NDEBUG)
+    const char* files[] = {"../data/unit_cube.off", "../data/bunny.off", "../data/bumpy_cube.off"};
+    for (int meshIndex = 0; meshIndex < 30; meshIndex++) {
+        Mesh mesh = Mesh::fromOffFile(files[meshIndex % 3], Vector3f(1.0, 0.5, 0.0), (RenderType) (meshIndex / 3 % 3));
+        mesh.scaleToUnitCube();
+        mesh.translate(Vector3f(meshIndex % 6 - 2.5f, meshIndex / 6 - 2.0f, 0.0f));
+        world.addMesh(mesh);
+    }
+    world.setSelectedMeshIndex(0);
+    deformingMeshIds.insert(world.getMeshId(1));
+    const Vector2i windowSize(800, 600);
+    Camera camera(Vector3f(0., 0., 8.), Vector3f(0., 0., 0.),
+            Camera::PROJECTION_PERSPECTIVE, (float) windowSize(0) / windowSize(1), -0.5, -100.0, (3.14/180) * 90);
+    world.addCamera(camera);
+    // Hover queries that build hierarchies go over their budget, and the ones after them move to a
+    // copy of the world on the worker of the picker. Built up front, every query stays on this thread.
+    for (const Mesh& mesh : world.getMeshes()) {
+        mesh.getGeometry()->getBvh();
+    }
+    RayHit hit;
+    world.pick(camera.getCameraPosition(), -Vector3f::UnitZ(), hit);
+    hoverPicker.setEnabled(true);
+
+    FrameResources frame;
+    frame.streamBuffer.initInMemory(1 << 16);
+    const int numWarmUpFrames = 10;
+    const int numFrames = 100;
+    long numAllocations = 0;
+    for (int frameNumber = -numWarmUpFrames; frameNumber < numFrames; frameNumber++) {
+        // The first frames build the picking hierarchy and grow the buffers
+        int step = frameNumber + numWarmUpFrames;
+        hoverPicker.moveCursor(step * 7 % windowSize(0), step * 3 % windowSize(1));
+        long start = AllocationCounter::getCount();
+        Eigen::internal::set_is_malloc_allowed(frameNumber < 0);
+        prepareFrame(frame, windowSize, windowSize, frameNumber / 60.0f);
+        frame.streamBuffer.endFrame();
+        Eigen::internal::set_is_malloc_allowed(true);
+        if (frameNumber >= 0) {
+            numAllocations += AllocationCounter::getCount() - start;
+        }
+    }
+    cout << numFrames << " frames of " << world.getMeshes().size() << " meshes in "
+         << frame.instanceBatches.getBatches().size() << " batches, " << hoverPicker.getNumQueries()
+         << " hover queries: " << numAllocations << " allocations" << endl;
+    return numAllocations == 0 ? 0 : 1;
+#else
+    cerr << "Build with -DCOUNT_ALLOCATIONS=ON and assertions enabled to check allocations" << endl;
+    return 1;
+#endif
+}
+
+// Whether a hit of a triangle kernel is the hit of Utils::rayTriangleIntersect up to rounding. A
+// different face only passes at the same distance, where the faces meet.
+bool matchesHit(const RayHit& hit, const RayHit& expected, float& maxDifference) {
+    const float tolerance = 1e-4f;
+    if ((hit.face == UINT32_MAX) != (expected.face == UINT32_MAX)) {
+        return false;
+    }
+    if (hit.face == UINT32_MAX) {
+        return true;
+    }
+    float difference = abs(hit.t - expected.t) / max(1.0f, expected.t);
+    if (hit.face == expected.face) {
+        difference = max(difference, max(abs(hit.u - expected.u), abs(hit.v - expected.v)));
+    }
+    maxDifference = max(maxDifference, difference);
+    return difference <= tolerance;
+}
+
+// Checks every triangle kernel against Utils::rayTriangleIntersect on every face and measures
+// them, through the hierarchy and on all blocks at once, for single rays and packets of 8 rays
+// aimed at nearby points. Fails if any hit differs by more than rounding.
+int benchmarkTriangles() {
+    const int packetSize = 8;
+    const int numRays = 4096;
+    const TriangleBlocks::Isa isas[] = {TriangleBlocks::ISA_SCALAR, TriangleBlocks::ISA_SSE,
+                                        TriangleBlocks::ISA_AVX2, TriangleBlocks::ISA_AVX512};
+    bool matches = true;
+    for (const char* file : {"../data/bunny.off", "../data/bumpy_cube.off"}) {
+        shared_ptr<const Geometry> geometry = Geometry::fromOffFile(file);
+        const Matrix3Xf& vertices = geometry->getVertices();
+        const Matrix3Xu& faces = geometry->getFaces();
+        const TriangleBlocks& triangleBlocks = geometry->getTriangleBlocks();
+        Vector3f center = (geometry->getBoundsMin() + geometry->getBoundsMax()) / 2;
+        Vector3f extent = geometry->getBoundsMax() - geometry->getBoundsMin();
+        float radius = extent.norm();
+
+        mt19937 random(1);
+        uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        vector<Vector3f> origins(numRays), directions(numRays);
+        for (int first = 0; first < numRays; first += packetSize) {
+            Vector3f side = Vector3f(unit(random), unit(random), unit(random)).normalized();
+            Vector3f target = center + 0.5f * Vector3f(unit(random), unit(random), unit(random)).cwiseProduct(extent);
+            for (int ray = first; ray < first + packetSize; ray++) {
+                Vector3f jitter = 0.02f * radius * Vector3f(unit(random), unit(random), unit(random));
+                origins[ray] = center + radius * side + jitter;
+                directions[ray] = (target + jitter - origins[ray]).normalized();
+            }
+        }
+
+        vector<RayHit> expected(numRays);
+        for (int ray = 0; ray < numRays; ray++) {
+            for (long face = 0; face < faces.cols(); face++) {
+                float t, u, v;
+                if (Utils::rayTriangleIntersect(origins[ray], directions[ray], vertices.col(faces(0, face)),
+                        vertices.col(faces(1, face)), vertices.col(faces(2, face)), t, u, v) && t < expected[ray].t) {
+                    expected[ray].t = t;
+                    expected[ray].face = (uint32_t) face;
+                    expected[ray].u = u;
+                    expected[ray].v = v;
+                }
+            }
+        }
+
+        cout << file << ": " << faces.cols() << " faces in " << triangleBlocks.getNumBlocks() << " blocks, "
+             << triangleBlocks.getMemoryUsage() << " bytes" << endl;
+        for (TriangleBlocks::Isa isa : isas) {
+            if (!TriangleBlocks::isSupported(isa)) {
+                cout << "  " << TriangleBlocks::getIsaName(isa) << ": not supported" << endl;
+                continue;
+            }
+            // Runs a pass over all rays until a fifth of a second has passed, and checks its hits
+            float maxDifference = 0;
+            auto measure = [&](const function<void(vector<RayHit>&)>& pass) {
+                vector<RayHit> hits;
+                long numPasses = 0;
+                auto start = chrono::steady_clock::now();
+                double seconds = 0;
+                while (seconds < 0.2) {
+                    hits.assign(numRays, RayHit());
+                    pass(hits);
+                    numPasses++;
+                    seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                }
+                for (int ray = 0; ray < numRays; ray++) {
+                    matches = matchesHit(hits[ray], expected[ray], maxDifference) && matches;
+                }
+                return numPasses * numRays / seconds;
+            };
+
+            double rays = measure([&](vector<RayHit>& hits) {
+                for (int ray = 0; ray < numRays; ray++) {
+                    triangleBlocks.intersectBlocks(0, triangleBlocks.getNumBlocks(), &origins[ray], &directions[ray], 1,
+                                                   &hits[ray], isa);
+                }
+            });
+            double packetRays = measure([&](vector<RayHit>& hits) {
+                for (int ray = 0; ray < numRays; ray += packetSize) {
+                    triangleBlocks.intersectBlocks(0, triangleBlocks.getNumBlocks(), &origins[ray], &directions[ray],
+                                                   packetSize, &hits[ray], isa);
+                }
+            });
+            double bvhRays = measure([&](vector<RayHit>& hits) {
+                for (int ray = 0; ray < numRays; ray++) {
+                    triangleBlocks.intersect(origins[ray], directions[ray], hits[ray], isa);
+                }
+            });
+            double bvhPacketRays = measure([&](vector<RayHit>& hits) {
+                for (int ray = 0; ray < numRays; ray += packetSize) {
+                    triangleBlocks.intersect(&origins[ray], &directions[ray], packetSize, &hits[ray], isa);
+                }
+            });
+            cout << "  " << TriangleBlocks::getIsaName(isa) << ", hits differ by at most " << maxDifference << endl
+                 << "    all blocks: " << rays * faces.cols() / 1e6 << " M triangles/s, packets of "
+                 << packetSize << ": " << packetRays * faces.cols() / 1e6 << " M triangles/s" << endl
+                 << "    hierarchy: " << bvhRays / 1e6 << " M rays/s, packets of " << packetSize << ": "
+                 << bvhPacketRays / 1e6 << " M rays/s" << endl;
+        }
+    }
+    cout << (matches ? "All kernels match Utils::rayTriangleIntersect" : "Kernels differ from Utils::rayTriangleIntersect")
+         << endl;
+    return matches ? 0 : 1;
+}
+
+// Whether both adjacencies have the same edges and the same faces around every edge
+bool sameAdjacency(const Adjacency& adjacency, const Adjacency& expected) {
+    if (adjacency.getEdges() != expected.getEdges() || adjacency.getFaceEdges() != expected.getFaceEdges()) {
+        return false;
+    }
+    for (long edge = 0; edge < expected.getNumEdges(); edge++) {
+        if (adjacency.endEdgeFaces(edge) - adjacency.beginEdgeFaces(edge)
+                != expected.endEdgeFaces(edge) - expected.beginEdgeFaces(edge)
+            || !equal(adjacency.beginEdgeFaces(edge), adjacency.endEdgeFaces(edge), expected.beginEdgeFaces(edge))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int benchmarkAdjacency() {
+    // A face with a repeated vertex is on its one edge once, next to the face it shares it with
+    Matrix3Xu degenerateFaces(3, 2);
+    degenerateFaces << 0, 0,
+                       0, 1,
+                       1, 2;
+    Adjacency degenerate(degenerateFaces, 3);
+    bool matches = degenerate.getNumEdges() == 3 && degenerate.getEdges()(0, 0) == 0
+            && degenerate.getEdges()(1, 0) == 1 && degenerate.endEdgeFaces(0) - degenerate.beginEdgeFaces(0) == 2;
+
+    // A grid of quads split into two triangles each, large enough for the pool
+    const long side = 1024;
+    Matrix3Xf gridVertices(3, side * side);
+    Matrix3Xu gridFaces(3, 2 * (side - 1) * (side - 1));
+    for (long y = 0; y < side; y++) {
+        for (long x = 0; x < side; x++) {
+            gridVertices.col(y * side + x) << (float) x, (float) y, 0.0f;
+            if (x + 1 < side && y + 1 < side) {
+                uint32_t corner = (uint32_t) (y * side + x);
+                uint32_t above = corner + (uint32_t) side;
+                long quad = y * (side - 1) + x;
+                gridFaces.col(2 * quad) << corner, corner + 1, above + 1;
+                gridFaces.col(2 * quad + 1) << corner, above + 1, above;
+            }
+        }
+    }
+
+    struct Input {
+        string name;
+        Matrix3Xu faces;
+        long numVertices;
+    };
+    vector<Input> inputs;
+    for (const char* file : {"../data/bunny.off", "../data/bumpy_cube.off"}) {
+        shared_ptr<const Geometry> geometry = Geometry::fromOffFile(file);
+        inputs.push_back({file, geometry->getFaces(), geometry->getVertices().cols()});
+    }
+    inputs.push_back({"grid", gridFaces, gridVertices.cols()});
+
+    for (const Input& input : inputs) {
+        // Builds the adjacency until a fifth of a second has passed, returns milliseconds per build
+        auto measure = [&](ThreadPool* pool) {
+            long numBuilds = 0;
+            auto start = chrono::steady_clock::now();
+            double seconds = 0;
+            while (seconds < 0.2) {
+                Adjacency adjacency(input.faces, input.numVertices, pool);
+                numBuilds++;
+                seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            }
+            return 1000 * seconds / numBuilds;
+        };
+        Adjacency serial(input.faces, input.numVertices);
+        Adjacency parallel(input.faces, input.numVertices, &ThreadPool::shared());
+        matches = sameAdjacency(parallel, serial) && matches;
+        cout << input.name << ": " << input.faces.cols() << " faces, " << serial.getNumEdges() << " edges, "
+             << (double) serial.getMemoryUsage() / input.faces.cols() << " bytes per face" << endl
+             << "  built in " << measure(nullptr) << " ms, " << measure(&ThreadPool::shared()) << " ms on "
+             << ThreadPool::shared().size() << " threads" << endl;
+    }
+    cout << (matches ? "Adjacency is the same on the pool and without duplicate edge faces"
+                     : "Adjacency differs on the pool or has duplicate edge faces") << endl;
+    return matches ? 0 : 1;
+}
+
+int checkSelection() {
+    // The clip matrix is the identity, so the triangles are given on screen with their depth in z
+    struct Case {
+        const char* name;
+        Vector3f a, b, c;
+        bool expected;
+    };
+    const Case cases[] = {
+        {"inside", Vector3f(-0.2f, -0.2f, 0), Vector3f(0.2f, -0.2f, 0), Vector3f(0, 0.2f, 0), true},
+        {"around the rectangle", Vector3f(-5, -5, 0), Vector3f(5, -5, 0), Vector3f(0, 5, 0), true},
+        {"across a corner", Vector3f(0.6f, 0.3f, 0), Vector3f(0.3f, 0.6f, 0), Vector3f(0.9f, 0.9f, 0), true},
+        // Every plane has a corner of the triangle on its inside
+        {"outside a corner", Vector3f(0.8f, 0.3f, 0), Vector3f(0.3f, 0.8f, 0), Vector3f(0.9f, 0.9f, 0), false},
+        {"beyond the far plane", Vector3f(-0.2f, -0.2f, 2), Vector3f(0.2f, -0.2f, 2), Vector3f(0, 0.2f, 2), false},
+        {"into the far plane", Vector3f(0.6f, 0.3f, 2), Vector3f(0.3f, 0.6f, 0), Vector3f(0.9f, 0.9f, 0), true},
+        {"out of the far plane", Vector3f(0.8f, 0.3f, -0.5f), Vector3f(0.3f, 0.8f, 0), Vector3f(0.4f, 0.4f, 6), false},
+    };
+    Vector2f rectangleMin(-0.5f, -0.5f), rectangleMax(0.5f, 0.5f);
+    vector<Vector2f> outline = {rectangleMin, Vector2f(0.5f, -0.5f), rectangleMax, Vector2f(-0.5f, 0.5f)};
+    SelectionFrustum rectangle = SelectionFrustum::rectangle(Matrix4f::Identity(), rectangleMin, rectangleMax);
+    SelectionFrustum lasso = SelectionFrustum::lasso(Matrix4f::Identity(), outline);
+    // The same cases moved by a model matrix, with the frustum moved into their object space
+    Matrix4f model = Matrix4f::Identity();
+    model.block<3, 1>(0, 3) = Vector3f(0.25f, -0.5f, 0.125f);
+    Matrix4f inverseModel = model.inverse();
+
+    bool matches = true;
+    for (const Case& test : cases) {
+        Vector3f a = (inverseModel * test.a.homogeneous()).head<3>();
+        Vector3f b = (inverseModel * test.b.homogeneous()).head<3>();
+        Vector3f c = (inverseModel * test.c.homogeneous()).head<3>();
+        bool results[] = {rectangle.intersectsTriangle(test.a, test.b, test.c),
+                          lasso.intersectsTriangle(test.a, test.b, test.c),
+                          rectangle.transformed(model).intersectsTriangle(a, b, c),
+                          lasso.transformed(model).intersectsTriangle(a, b, c)};
+        for (bool result : results) {
+            if (result != test.expected) {
+                cout << test.name << ": found " << (result ? "selected" : "not selected") << endl;
+                matches = false;
+            }
+        }
+    }
+    cout << (matches ? "Rectangle and lasso select exactly the triangles they overlap"
+                     : "Rectangle or lasso selection is wrong") << endl;
+    return matches ? 0 : 1;
+}
+
+int main(int argc, char** argv)
 {
-    GLFWwindow* window = HelperGL::initAndCreateGLFWWindow();
+    if (argc >= 3 && string(argv[1]) == "--render") {
+        int width = argc >= 5 ? atoi(argv[3]) : 800;
+        int height = argc >= 5 ? atoi(argv[4]) : 600;
+        return renderHeadless(argv[2], width, height);
+    }
+    if (argc == 2 && string(argv[1]) == "--check-allocations") {
+        return checkAllocations();
+    }
+    if (argc == 2 && string(argv[1]) == "--benchmark-triangles") {
+        return benchmarkTriangles();
+    }
+    if (argc == 2 && string(argv[1]) == "--benchmark-adjacency") {
+        return benchmarkAdjacency();
+    }
+    if (argc == 2 && string(argv[1]) == "--check-selection") {
+        return checkSelection();
+    }
+    if (argc >= 2) {
+        cerr << "Usage: " << argv[0] << " [--render image.ppm [width height] | --check-allocations"
+             << " | --check-selection | --benchmark-triangles | --benchmark-adjacency]" << endl;
+        return 1;
+    }
 
-    // Initialize the VAO
-    // A Vertex Array Object (or VAO) is an object that describes how the vertex
-    // attributes are stored in a Vertex Buffer Object (or VBO). This means that
-    // the VAO is not the actual object storing the vertex data,
-    // but the descriptor of the vertex data.
-    VertexArrayObject VAO;
-    VAO.init();
-    VAO.bind();
-
-    // Initialize the VBO with the vertices data
-    // A VBO is a data container that lives in the GPU memory
-    VertexBufferObject VBO_Positions;
-    VBO_Positions.init();
-    VBO_Positions.update(Eigen::MatrixXf(3, 0));
-
-    VertexBufferObject VBO_VertexNormals;
-    VBO_VertexNormals.init();
-    VBO_VertexNormals.update(Eigen::MatrixXf(3, 0));
-
-    VertexBufferObject VBO_FaceNormals;
-    VBO_FaceNormals.init();
-    VBO_FaceNormals.update(Eigen::MatrixXf(3, 0));
+    GLFWwindow* window = HelperGL::initAndCreateGLFWWindow();
 
     // Initialize the OpenGL Program
     // A program controls the OpenGL pipeline and it must contains
@@ -333,78 +1018,175 @@ int main()
             "#version 150 core\n"
             "in vec3 position;\n"
             "in vec3 vertex_normal;\n"
-            "in vec3 face_normal;\n"
+            "in float vertex_occlusion;\n"
+            "in mat4 instance_model;\n"
+            "in mat3 instance_normal_model;\n"
+            "in vec4 instance_color;\n"
+
+            "layout(std140) uniform Frame {\n"
+            "    mat4 view;\n"
+            "    mat4 projection;\n"
+            "    vec4 lightPos;\n"
+            "    vec4 viewPos;\n"
+            "    vec4 viewport;\n"
+            "};\n"
+
+            "out Vertex {\n"
+            "    vec3 Normal;\n"
+            "    vec3 FragPos;\n"
+            "    vec3 objectColor;\n"
+            "    float Occlusion;\n"
+            "} vertex;\n"
+
+            "void main()"
+            "{"
+            "    gl_Position = projection * view * instance_model * vec4(position, 1.0);"
+            "    vertex.FragPos = vec3(instance_model * vec4(position, 1.0f));"
+            "    vertex.Normal = instance_normal_model * vertex_normal;"
+            "    vertex.objectColor = instance_color.rgb;"
+            "    vertex.Occlusion = vertex_occlusion;"
+            "}";
+    // Passes the triangles through and gives every corner its distance in pixels to the opposite edge.
+    // Interpolated without perspective, the smallest of the three is the distance of a fragment to
+    // the nearest edge, so the fragment shader draws the edges in the same pass as the faces.
+    const GLchar* geometry_shader =
+            "#version 150 core\n"
+            "layout(triangles) in;\n"
+            "layout(triangle_strip, max_vertices = 3) out;\n"
 
-            "uniform vec3 color;\n"
-            "uniform bool flat_normal;\n"
+            "layout(std140) uniform Frame {\n"
+            "    mat4 view;\n"
+            "    mat4 projection;\n"
+            "    vec4 lightPos;\n"
+            "    vec4 viewPos;\n"
+            "    vec4 viewport;\n"
+            "};\n"
 
-            "uniform mat4 projection;\n"
-            "uniform mat4 model;\n"
-            "uniform mat4 view;\n"
+            "in Vertex {\n"
+            "    vec3 Normal;\n"
+            "    vec3 FragPos;\n"
+            "    vec3 objectColor;\n"
+            "    float Occlusion;\n"
+            "} vertices[];\n"
 
-            "out vec3 Normal;\n"
-            "out vec3 FragPos;\n"
-            "out vec3 objectColor;\n"
+            "out Vertex {\n"
+            "    vec3 Normal;\n"
+            "    vec3 FragPos;\n"
+            "    vec3 objectColor;\n"
+            "    float Occlusion;\n"
+            "} fragment;\n"
+            "noperspective out vec3 EdgeDistance;\n"
 
             "void main()"
             "{"
-            "    gl_Position = projection * view * model * vec4(position, 1.0);"
-            "    FragPos = vec3(model * vec4(position, 1.0f));"
-            "    if(flat_normal){"
-            "       Normal = mat3(transpose(inverse(model))) * face_normal;"
-            "    }else{"
-            "       Normal = mat3(transpose(inverse(model))) * vertex_normal;"
+            "    vec2 corners[3];"
+            "    bool behind = false;"
+            "    for (int i = 0; i < 3; i++) {"
+            "        behind = behind || gl_in[i].gl_Position.w <= 0.0;"
+            "        corners[i] = gl_in[i].gl_Position.xy / gl_in[i].gl_Position.w * viewport.xy / 2.0;"
             "    }"
-            "    objectColor = color;"
+            "    vec2 edge0 = corners[2] - corners[1];"
+            "    vec2 edge1 = corners[0] - corners[2];"
+            "    vec2 edge2 = corners[1] - corners[0];"
+            "    float area = abs(edge1.x * edge2.y - edge1.y * edge2.x);"
+            "    vec3 heights = area / max(vec3(length(edge0), length(edge1), length(edge2)), 1e-6);"
+            // Triangles reaching behind the camera have no meaningful screen positions, they get no edges
+            "    if (behind) heights = vec3(1e6);"
+            "    for (int i = 0; i < 3; i++) {"
+            "        gl_Position = gl_in[i].gl_Position;"
+            "        fragment.Normal = vertices[i].Normal;"
+            "        fragment.FragPos = vertices[i].FragPos;"
+            "        fragment.objectColor = vertices[i].objectColor;"
+            "        fragment.Occlusion = vertices[i].Occlusion;"
+            "        EdgeDistance = vec3(0.0);"
+            "        EdgeDistance[i] = heights[i];"
+            "        EmitVertex();"
+            "    }"
+            "    EndPrimitive();"
             "}";
+    // Compiled after a version line, and with EDGES defined for the program with the geometry shader
     const GLchar* fragment_shader =
-            "#version 150 core\n"
-
-            "in vec3 Normal;"
-            "in vec3 FragPos;"
-            "in vec3 objectColor;"
+            "in Vertex {\n"
+            "    vec3 Normal;\n"
+            "    vec3 FragPos;\n"
+            "    vec3 objectColor;\n"
+            "    float Occlusion;\n"
+            "};\n"
+            "#ifdef EDGES\n"
+            "noperspective in vec3 EdgeDistance;\n"
+            "#endif\n"
 
             "out vec4 outColor;"
 
-            "uniform vec3 lightPos;"
-            "uniform vec3 viewPos;"
-            "uniform bool flat_normal;"
+            "layout(std140) uniform Frame {"
+            "    mat4 view;"
+            "    mat4 projection;"
+            "    vec4 lightPos;"
+            "    vec4 viewPos;"
+            "    vec4 viewport;"
+            "};"
+            "layout(std140) uniform Draw {"
+            "    bool flat_normal;"
+            "    bool baked_occlusion;"
+            "};"
 
             "void main()"
             "{"
             "    vec3 lightColor = vec3(1.0, 1.0, 1.0);"
-            "      float ambientStrength = 0.01f;"
+            // Baked occlusion darkens the creases, so the ambient light can be much stronger
+            "      float ambientStrength = baked_occlusion ? 0.25f * Occlusion : 0.01f;"
             "      vec3 ambient = ambientStrength * lightColor;"
-            "      vec3 norm = normalize(Normal);"
-            "      vec3 lightDir = normalize(lightPos - FragPos);"
+            // Vertices are shared between faces, so the face normal comes from the screen space
+            // derivatives of the position, which are constant across a triangle
+            "      vec3 norm = flat_normal ? normalize(cross(dFdx(FragPos), dFdy(FragPos))) : normalize(Normal);"
+            "      vec3 lightDir = normalize(lightPos.xyz - FragPos);"
             "      float diff = max(dot(norm, lightDir), 0.0);"
             "      vec3 diffuse = diff * lightColor;"
+            "      vec3 result;"
             "      if(flat_normal){"
-            "         vec3 result = (ambient + diffuse) * objectColor;"
-            "         outColor = vec4(result, 1.0);"
+            "         result = (ambient + diffuse) * objectColor;"
             "       }else{"
             "         float specularStrength = 0.5f;"
-            "         vec3 viewDir = normalize(viewPos - FragPos);"
+            "         vec3 viewDir = normalize(viewPos.xyz - FragPos);"
             "         vec3 reflectDir = reflect(-lightDir, norm);  "
             "         float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);"
             "         vec3 specular = specularStrength * spec * lightColor;  "
-            "         vec3 result = (ambient + diffuse + specular) * objectColor;"
-            "         outColor = vec4(result, 1.0);"
+            "         result = (ambient + diffuse + specular) * objectColor;"
             "       }"
+            // Black on an edge, fading out over a pixel to each side like an antialiased line
+            "\n#ifdef EDGES\n"
+            "      float edgeDistance = min(EdgeDistance.x, min(EdgeDistance.y, EdgeDistance.z));"
+            "      result *= smoothstep(0.0, 1.0, edgeDistance);"
+            "\n#endif\n"
+            "      outColor = vec4(result, 1.0);"
             "}";
 
-    // Compile the two shaders and upload the binary to the GPU
+    // Compile the three shaders and upload the binary to the GPU
     // Note that we have to explicitly specify that the output "slot" called outColor
     // is the one that we want in the fragment buffer (and thus on screen)
-    program.init(vertex_shader,fragment_shader,"outColor");
+    const string fragment_version = "#version 150 core\n";
+    program.init(vertex_shader,fragment_version + "#define EDGES\n" + fragment_shader,"outColor",geometry_shader);
     program.bind();
+    program.bindUniformBlock("Frame", FRAME_UNIFORMS_BINDING);
+    program.bindUniformBlock("Draw", DRAW_UNIFORMS_BINDING);
+    // Draws without edges skip the geometry shader, and read the same vertex arrays
+    Program programWithoutEdges;
+    programWithoutEdges.init(vertex_shader,fragment_version + fragment_shader,"outColor");
+    programWithoutEdges.shareAttribLocations(program);
+    programWithoutEdges.bindUniformBlock("Frame", FRAME_UNIFORMS_BINDING);
+    programWithoutEdges.bindUniformBlock("Draw", DRAW_UNIFORMS_BINDING);
+    // Every geometry is uploaded into a vertex array of its own the first time it is drawn, which
+    // connects its buffers with the position, normal and occlusion inputs of the vertex shader
+    GpuGeometryCache geometryBuffers(program);
 
-    // The vertex shader wants the position of the vertices as an input.
-    // The following line connects the VBO we defined above with the position "slot"
-    // in the vertex shader
-    program.bindVertexAttribArray("position", VBO_Positions);
-    program.bindVertexAttribArray("vertex_normal", VBO_VertexNormals);
-    program.bindVertexAttribArray("face_normal", VBO_FaceNormals);
+    FrameResources frame;
+    StreamBuffer& streamBuffer = frame.streamBuffer;
+    streamBuffer.init(1 << 20);
+    GLint uniformAlignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    frame.uniformAlignment = (size_t) uniformAlignment;
+    // Frames that uploaded geometry, reported at exit
+    long numUploadFrames = 0;
 
     // Save the current time --- it will be used to dynamically change the triangle color
     auto t_start = std::chrono::high_resolution_clock::now();
@@ -420,6 +1202,9 @@ int main()
 
     glfwSetWindowSizeCallback(window, window_size_callback);
 
+    // Hover highlighting follows the cursor while it is switched on with H
+    glfwSetCursorPosCallback(window, cursor_position_callback);
+
     int screenWidth, screenHeight;
     glfwGetWindowSize(window, &screenWidth, &screenHeight);
     Camera camera(Vector3f(0., 0., 3.), Vector3f(0., 0., 0.),
@@ -428,16 +1213,20 @@ int main()
 
     // Loop until the user closes the window
     while (!glfwWindowShouldClose(window)) {
-        // Bind your VAO (not necessary if you have only one)
-        VAO.bind();
+        // Swap in meshes that finished loading in the background
+        meshLoader.processCompleted();
+        stepOcclusionBakes();
+        updateWindowTitle(window);
+
+        // Frees the buffers of geometry whose meshes have all been removed
+        geometryBuffers.beginFrame();
 
         // Bind your program
         program.bind();
 
-        // Set the uniform value depending on the time difference
+        // Drives the wave of deforming meshes
         auto t_now = std::chrono::high_resolution_clock::now();
         float time = std::chrono::duration_cast<std::chrono::duration<float>>(t_now - t_start).count();
-        glUniform3f(program.uniform("triangleColor"), (float)(sin(time * 4.0f) + 1.0f) / 2.0f, 0.0f, 0.0f);
 
         // Clear the framebuffer
         glEnable(GL_DEPTH_TEST);
@@ -445,36 +1234,26 @@ int main()
         glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
-        //Set the camera view
-        glUniformMatrix4fv(program.uniform("view"), 1, GL_FALSE, world.getViewCamera().getView().data());
-        glUniformMatrix4fv(program.uniform("projection"), 1, GL_FALSE, world.getViewCamera().getProjection().data());
-        // Draw each mesh
-
-        for (int meshIndex = 0; meshIndex < world.getMeshes().size(); meshIndex++) {
-            Mesh mesh = world.getMeshes().at(meshIndex).get();
-            VBO_Positions.update(mesh.getTriangleVertices());
-            VBO_VertexNormals.update(mesh.getVertexNormals());
-            VBO_FaceNormals.update(mesh.getFaceNormals());
-
-            glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, mesh.getModel().data());
-            glPolygonMode(GL_FRONT_AND_BACK, getPolygonDrawType(mesh.getRenderType()));
-            if (world.getSelectedMeshIndex() == meshIndex) {
-                glUniform3f(program.uniform("color"), 0.0, 0.0, 1.0);
-            } else {
-                glUniform3f(program.uniform("color"), mesh.getColor()(0), mesh.getColor()(1), mesh.getColor()(2));
-            }
-            glUniform1i(program.uniform("flat_normal"), mesh.getRenderType() != PHONG_SHADE);
-            glUniform3f(program.uniform("lightPos"), -5.0, 0.0, 10.0);
-            glUniform3f(program.uniform("viewPos"), camera.getCameraPosition()(0), camera.getCameraPosition()(1),
-                        camera.getCameraPosition()(2));
-
-            glDrawArrays(GL_TRIANGLES, 0, mesh.getFaces().cols() * mesh.getFaces().rows());
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        prepareFrame(frame, getWindowSize(window), Vector2i(framebufferWidth, framebufferHeight), time);
+        streamBuffer.bindUniformBlock(FRAME_UNIFORMS_BINDING, frame.frameUniformsOffset, sizeof(FrameUniforms));
 
-            if (mesh.getRenderType() == FLAT_SHADE) {
-                glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-                glUniform3f(program.uniform("color"), 0.0, 0.0, 0.0);
-                glDrawArrays(GL_TRIANGLES, 0, mesh.getFaces().cols() * mesh.getFaces().rows());
-            }
+        const vector<InstanceBatches::Batch>& batches = frame.instanceBatches.getBatches();
+        frame.renderQueue.submit(streamBuffer, DRAW_UNIFORMS_BINDING, sizeof(DrawUniforms),
+                                 [&](unsigned programVariants) {
+            (programVariants & VARIANT_EDGES ? program : programWithoutEdges).bind();
+        }, [&](int batchIndex) -> const ElementBufferObject& {
+            const InstanceBatches::Batch& batch = batches[batchIndex];
+            const GpuGeometryCache::Buffers& buffers = frame.streamedPositions[batchIndex] == -1
+                    ? geometryBuffers.bind(batch.geometry)
+                    : geometryBuffers.bind(batch.geometry, streamBuffer, frame.streamedPositions[batchIndex]);
+            geometryBuffers.bindInstances(streamBuffer, batch.instancesOffset);
+            return buffers.elements;
+        });
+        streamBuffer.endFrame();
+        if (geometryBuffers.getFrameUploadBytes() > 0) {
+            numUploadFrames++;
         }
 
 //        MatrixXf identityModel = MatrixXf::Identity(4, 4);
@@ -493,10 +1272,24 @@ int main()
         glfwPollEvents();
     }
 
+    hoverPicker.printStatistics();
+    if (numSelections > 0) {
+        cout << "Selection: " << numSelections << " selections, mean " << totalSelectionMilliseconds / numSelections
+             << " ms, max " << maxSelectionMilliseconds << " ms" << endl;
+    }
+    frame.renderQueue.printStatistics();
+
     // Deallocate opengl memory
     program.free();
-    VAO.free();
-    VBO_Positions.free();
+    programWithoutEdges.free();
+    cout << "GPU uploads: " << geometryBuffers.getTotalUploadBytes() << " bytes in total over " << numUploadFrames
+         << " frames, " << geometryBuffers.size() << " geometries resident" << endl;
+    geometryBuffers.clear();
+    cout << "Streamed " << streamBuffer.getTotalBytes() << " bytes in total, " << streamedVertexBytes
+         << " of them deformed vertices"
+         << (streamBuffer.isPersistent() ? " through a persistent mapping, " : " through glMapBufferRange, ")
+         << streamBuffer.getNumStalls() << " frames waited for the GPU" << endl;
+    streamBuffer.free();
 
     // Deallocate glfw internals
     glfwTerminate();